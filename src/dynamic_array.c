@@ -47,6 +47,18 @@ void da_put(DynamicArray *da, char *val)
   da->data[da->size++] = strdup(val);
 }
 
+// Overwrite element at an index, padding any gap with empty strings
+void da_set(DynamicArray *da, const size_t ind, const char *val)
+{
+  while (da->size <= ind)
+  {
+    da_put(da, "");
+  }
+
+  free(da->data[ind]);
+  da->data[ind] = strdup(val);
+}
+
 // Get element at an index (NULL if not found)
 char *da_get(DynamicArray *da, const size_t ind)
 {
@@ -1,3 +1,6 @@
+#ifndef DYNAMIC_ARRAY_H
+#define DYNAMIC_ARRAY_H
+
 #include <unistd.h>
 
 typedef struct {
@@ -12,6 +15,9 @@ DynamicArray* da_create(size_t init_capacity);
 // Add element to Dynamic Array at the end. Handles resizing if necessary
 void da_put(DynamicArray *da, char* val);
 
+// Overwrite element at an index, padding any gap with empty strings
+void da_set(DynamicArray *da, const size_t ind, const char *val);
+
 // Get element at an index (NULL if not found)
 char *da_get(DynamicArray *da, const size_t ind);
 
@@ -23,3 +29,5 @@ void da_print(DynamicArray *da);
 
 // Free whole DynamicArray
 void da_free(DynamicArray *da);
+
+#endif // DYNAMIC_ARRAY_H
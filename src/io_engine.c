@@ -0,0 +1,849 @@
+#define _GNU_SOURCE
+#include "io_engine.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#define IOE_CANCEL_TAG (~0ULL) // user_data of cancel requests, whose results are ignored
+
+// A request in flight
+typedef struct {
+  int in_use;
+  int done;
+  int res;          // result from the completion queue
+  int buffer;       // registered buffer used by the request
+  size_t len;
+  long long offset; // file offset, -1 for the current position
+} IoOp;
+
+// Per-process engine state. A forked child sets up its own ring on first use.
+static struct {
+  int initialized;
+  pid_t owner;
+  IoBackend backend;
+
+  int ring_fd;
+  void *sq_ptr, *cq_ptr;
+  size_t sq_size, cq_size;
+  struct io_uring_sqe *sqes;
+  size_t sqes_size;
+  unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+  unsigned *cq_head, *cq_tail, *cq_mask;
+  struct io_uring_cqe *cqes;
+
+  char *buffers;
+  int buffer_used[IOE_NUM_BUFFERS];
+  int fixed_buffers; // 1 if buffers are registered with the ring
+  int fixed_files;   // 1 if the (sparse) file table is registered
+  int file_used[IOE_MAX_FILES];
+
+  IoOp ops[IOE_QUEUE_DEPTH];
+} ioe;
+
+/***************************************************
+ * Ring setup
+ ***************************************************/
+
+static void ioe_unmap(void)
+{
+  if (ioe.sqes != NULL && ioe.sqes != MAP_FAILED)
+  {
+    munmap(ioe.sqes, ioe.sqes_size);
+  }
+  if (ioe.cq_ptr != NULL && ioe.cq_ptr != MAP_FAILED && ioe.cq_ptr != ioe.sq_ptr)
+  {
+    munmap(ioe.cq_ptr, ioe.cq_size);
+  }
+  if (ioe.sq_ptr != NULL && ioe.sq_ptr != MAP_FAILED)
+  {
+    munmap(ioe.sq_ptr, ioe.sq_size);
+  }
+  if (ioe.buffers != NULL && ioe.buffers != MAP_FAILED)
+  {
+    munmap(ioe.buffers, (size_t)IOE_NUM_BUFFERS * IOE_BUFFER_SIZE);
+  }
+  if (ioe.ring_fd > 0)
+  {
+    close(ioe.ring_fd);
+  }
+  memset(&ioe, 0, sizeof(ioe));
+}
+
+/**
+ * @Brief Create the ring, map its queues and register the buffer pool and
+ * an empty file table. Registration failures only disable that feature.
+ *
+ * @return 0 on success, -1 if io_uring can't be used
+ */
+static int ioe_setup_ring(void)
+{
+  struct io_uring_params p;
+  memset(&p, 0, sizeof(p));
+  int fd = (int)syscall(__NR_io_uring_setup, IOE_QUEUE_DEPTH, &p);
+  if (fd < 0)
+  {
+    return -1;
+  }
+  ioe.ring_fd = fd;
+  fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+  // offset -1 (current file position) is what makes pipes usable.
+  if (!(p.features & IORING_FEAT_RW_CUR_POS))
+  {
+    ioe_unmap();
+    return -1;
+  }
+
+  ioe.sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  ioe.cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  if (p.features & IORING_FEAT_SINGLE_MMAP)
+  {
+    if (ioe.cq_size > ioe.sq_size)
+    {
+      ioe.sq_size = ioe.cq_size;
+    }
+    ioe.cq_size = ioe.sq_size;
+  }
+  ioe.sq_ptr = mmap(NULL, ioe.sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                    fd, IORING_OFF_SQ_RING);
+  ioe.cq_ptr = (p.features & IORING_FEAT_SINGLE_MMAP)
+                   ? ioe.sq_ptr
+                   : mmap(NULL, ioe.cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                          fd, IORING_OFF_CQ_RING);
+  ioe.sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+  ioe.sqes = mmap(NULL, ioe.sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                  fd, IORING_OFF_SQES);
+  ioe.buffers = mmap(NULL, (size_t)IOE_NUM_BUFFERS * IOE_BUFFER_SIZE, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (ioe.sq_ptr == MAP_FAILED || ioe.cq_ptr == MAP_FAILED || ioe.sqes == MAP_FAILED ||
+      ioe.buffers == MAP_FAILED)
+  {
+    ioe_unmap();
+    return -1;
+  }
+
+  char *sq = ioe.sq_ptr;
+  char *cq = ioe.cq_ptr;
+  ioe.sq_head = (unsigned *)(sq + p.sq_off.head);
+  ioe.sq_tail = (unsigned *)(sq + p.sq_off.tail);
+  ioe.sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+  ioe.sq_array = (unsigned *)(sq + p.sq_off.array);
+  ioe.cq_head = (unsigned *)(cq + p.cq_off.head);
+  ioe.cq_tail = (unsigned *)(cq + p.cq_off.tail);
+  ioe.cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+  ioe.cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+  // Registered buffers are pinned once instead of on every request.
+  struct iovec iov[IOE_NUM_BUFFERS];
+  for (int i = 0; i < IOE_NUM_BUFFERS; i++)
+  {
+    iov[i].iov_base = ioe.buffers + (size_t)i * IOE_BUFFER_SIZE;
+    iov[i].iov_len = IOE_BUFFER_SIZE;
+  }
+  ioe.fixed_buffers =
+      syscall(__NR_io_uring_register, fd, IORING_REGISTER_BUFFERS, iov, IOE_NUM_BUFFERS) == 0;
+
+  // Sparse file table: slots are filled in as streams are opened.
+  int fds[IOE_MAX_FILES];
+  for (int i = 0; i < IOE_MAX_FILES; i++)
+  {
+    fds[i] = -1;
+  }
+  ioe.fixed_files =
+      syscall(__NR_io_uring_register, fd, IORING_REGISTER_FILES, fds, IOE_MAX_FILES) == 0;
+  return 0;
+}
+
+/* Backend in use by this process, set up on first call */
+IoBackend ioe_backend(void)
+{
+  if (ioe.initialized && ioe.owner == getpid())
+  {
+    return ioe.backend;
+  }
+  if (ioe.initialized)
+  {
+    // inherited through fork(): the ring belongs to the parent.
+    ioe_unmap();
+  }
+
+  ioe.backend = IOE_SYNC;
+  const char *mode = getenv("WSH_IO");
+  if ((mode == NULL || strcmp(mode, "sync") != 0) && ioe_setup_ring() == 0)
+  {
+    ioe.backend = IOE_URING;
+  }
+  ioe.initialized = 1;
+  ioe.owner = getpid();
+  return ioe.backend;
+}
+
+/* Tear down the ring and free the buffers */
+void ioe_shutdown(void)
+{
+  if (ioe.initialized)
+  {
+    ioe_unmap();
+  }
+}
+
+/***************************************************
+ * Requests
+ ***************************************************/
+
+static int ioe_get_op(void)
+{
+  for (int i = 0; i < IOE_QUEUE_DEPTH; i++)
+  {
+    if (!ioe.ops[i].in_use)
+    {
+      memset(&ioe.ops[i], 0, sizeof(IoOp));
+      ioe.ops[i].in_use = 1;
+      return i;
+    }
+  }
+  return -1;
+}
+
+static int ioe_get_buffer(void)
+{
+  for (int i = 0; i < IOE_NUM_BUFFERS; i++)
+  {
+    if (!ioe.buffer_used[i])
+    {
+      ioe.buffer_used[i] = 1;
+      return i;
+    }
+  }
+  return -1;
+}
+
+/* Number of buffers not in use */
+static int ioe_free_buffers(void)
+{
+  int n = 0;
+  for (int i = 0; i < IOE_NUM_BUFFERS; i++)
+  {
+    n += !ioe.buffer_used[i];
+  }
+  return n;
+}
+
+static char *ioe_buffer_addr(int buffer)
+{
+  return ioe.buffers + (size_t)buffer * IOE_BUFFER_SIZE;
+}
+
+/* Register fd in a free file slot. Returns the slot, -1 if none */
+static int ioe_register_file(int fd)
+{
+  if (!ioe.fixed_files)
+  {
+    return -1;
+  }
+  for (int slot = 0; slot < IOE_MAX_FILES; slot++)
+  {
+    if (!ioe.file_used[slot])
+    {
+      struct io_uring_files_update update;
+      memset(&update, 0, sizeof(update));
+      update.offset = slot;
+      update.fds = (unsigned long)&fd;
+      if (syscall(__NR_io_uring_register, ioe.ring_fd, IORING_REGISTER_FILES_UPDATE, &update, 1) != 1)
+      {
+        return -1;
+      }
+      ioe.file_used[slot] = 1;
+      return slot;
+    }
+  }
+  return -1;
+}
+
+static void ioe_unregister_file(int slot)
+{
+  int fd = -1;
+  struct io_uring_files_update update;
+  memset(&update, 0, sizeof(update));
+  update.offset = slot;
+  update.fds = (unsigned long)&fd;
+  syscall(__NR_io_uring_register, ioe.ring_fd, IORING_REGISTER_FILES_UPDATE, &update, 1);
+  ioe.file_used[slot] = 0;
+}
+
+/* Current offset of a regular file, -1 for pipes, ttys and sockets */
+static long long ioe_stream_offset(int fd)
+{
+  struct stat st;
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+  {
+    return -1;
+  }
+  off_t pos = lseek(fd, 0, SEEK_CUR);
+  return pos < 0 ? -1 : pos;
+}
+
+/**
+ * @Brief Fill the next submission queue entry for a read or write of op.
+ * Uses the fixed-buffer and fixed-file variants when registered.
+ *
+ * @param opcode IORING_OP_READ or IORING_OP_WRITE
+ * @param fd File descriptor (used when slot < 0)
+ * @param slot Registered file slot, -1 if none
+ * @param op Index of the request (its buffer, len and offset are used)
+ * @param flags Extra IOSQE_* flags (eg: IOSQE_IO_LINK)
+ */
+static void ioe_prep(int opcode, int fd, int slot, int op, unsigned flags)
+{
+  unsigned tail = *ioe.sq_tail;
+  unsigned idx = tail & *ioe.sq_mask;
+  struct io_uring_sqe *sqe = &ioe.sqes[idx];
+  IoOp *o = &ioe.ops[op];
+
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = opcode;
+  if (ioe.fixed_buffers)
+  {
+    sqe->opcode = (opcode == IORING_OP_READ) ? IORING_OP_READ_FIXED : IORING_OP_WRITE_FIXED;
+    sqe->buf_index = o->buffer;
+  }
+  sqe->fd = (slot >= 0) ? slot : fd;
+  sqe->flags = flags | ((slot >= 0) ? IOSQE_FIXED_FILE : 0);
+  sqe->off = (unsigned long long)o->offset;
+  sqe->addr = (unsigned long)ioe_buffer_addr(o->buffer);
+  sqe->len = o->len;
+  sqe->user_data = op;
+
+  ioe.sq_array[idx] = idx;
+  __atomic_store_n(ioe.sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+/* Queue a request to cancel op (used for reads that may never complete) */
+static void ioe_prep_cancel(int op)
+{
+  unsigned tail = *ioe.sq_tail;
+  unsigned idx = tail & *ioe.sq_mask;
+  struct io_uring_sqe *sqe = &ioe.sqes[idx];
+
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->fd = -1;
+  sqe->addr = op;
+  sqe->user_data = IOE_CANCEL_TAG;
+
+  ioe.sq_array[idx] = idx;
+  __atomic_store_n(ioe.sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @Brief Submit every queued entry in one system call, optionally waiting
+ * for at least one completion. Retries when interrupted by a signal.
+ *
+ * @return 0 on success, -1 on error (errno set)
+ */
+static int ioe_enter(int wait)
+{
+  while (1)
+  {
+    unsigned to_submit = *ioe.sq_tail - __atomic_load_n(ioe.sq_head, __ATOMIC_ACQUIRE);
+    if (to_submit == 0 && !wait)
+    {
+      return 0;
+    }
+    long res = syscall(__NR_io_uring_enter, ioe.ring_fd, to_submit, wait ? 1 : 0,
+                       wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    if (res >= 0)
+    {
+      return 0;
+    }
+    if (errno != EINTR && errno != EAGAIN && errno != EBUSY)
+    {
+      return -1;
+    }
+    if (errno != EINTR)
+    {
+      wait = 1; // queues are full: let some requests complete first.
+    }
+  }
+}
+
+/* Record every available completion in its request */
+static void ioe_reap(void)
+{
+  unsigned head = *ioe.cq_head;
+  unsigned tail = __atomic_load_n(ioe.cq_tail, __ATOMIC_ACQUIRE);
+  while (head != tail)
+  {
+    struct io_uring_cqe *cqe = &ioe.cqes[head & *ioe.cq_mask];
+    if (cqe->user_data < IOE_QUEUE_DEPTH)
+    {
+      ioe.ops[cqe->user_data].res = cqe->res;
+      ioe.ops[cqe->user_data].done = 1;
+    }
+    head++;
+  }
+  __atomic_store_n(ioe.cq_head, head, __ATOMIC_RELEASE);
+}
+
+/* Wait until op has completed. Returns 0 on success, -1 on error */
+static int ioe_wait(int op)
+{
+  ioe_reap();
+  while (!ioe.ops[op].done)
+  {
+    if (ioe_enter(1) != 0)
+    {
+      ioe.ops[op].res = -errno;
+      ioe.ops[op].done = 1;
+      return -1;
+    }
+    ioe_reap();
+  }
+  return 0;
+}
+
+/* write(2)/pwrite(2) all of buf, retrying short writes */
+static int ioe_write_all(int fd, const char *buf, size_t len, long long offset)
+{
+  while (len > 0)
+  {
+    ssize_t n = (offset >= 0) ? pwrite(fd, buf, len, offset) : write(fd, buf, len);
+    if (n < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      return -1;
+    }
+    buf += n;
+    len -= n;
+    if (offset >= 0)
+    {
+      offset += n;
+    }
+  }
+  return 0;
+}
+
+/***************************************************
+ * Readers
+ ***************************************************/
+
+/* Start reading from fd, at explicit offsets only if fd is owned */
+void ioe_reader_open(IoReader *r, int fd, int owned)
+{
+  r->fd = fd;
+  r->slot = -1;
+  r->offset = -1;
+  r->num_buffers = 0;
+  r->head = 0;
+  r->lent = 0;
+  r->eof = 0;
+  if (ioe_backend() != IOE_URING)
+  {
+    return;
+  }
+  // reads at the current position can't overlap, so a second buffer is only
+  // filled while the caller scans the first. Past two buffers, half the pool
+  // is left to other streams.
+  int wanted = owned ? IOE_READ_AHEAD : 2;
+  while (r->num_buffers < wanted && (r->num_buffers < 2 || ioe_free_buffers() > IOE_NUM_BUFFERS / 2))
+  {
+    int buffer = ioe_get_buffer();
+    if (buffer < 0)
+    {
+      break;
+    }
+    r->buffers[r->num_buffers] = buffer;
+    r->ops[r->num_buffers] = -1;
+    r->num_buffers++;
+  }
+  // with the pool exhausted, this reader just uses read(2).
+  if (r->num_buffers == 0)
+  {
+    return;
+  }
+  // another process may share a file position we don't own: always read
+  // at the current position, or our offsets would race with its I/O.
+  r->offset = owned ? ioe_stream_offset(fd) : -1;
+  r->slot = ioe_register_file(fd);
+}
+
+/* Queue a read at offset into the reader's buffer i */
+static int ioe_queue_read(IoReader *r, int i, long long offset)
+{
+  int op = ioe_get_op();
+  if (op < 0)
+  {
+    errno = EBUSY;
+    return -1;
+  }
+  ioe.ops[op].buffer = r->buffers[i];
+  ioe.ops[op].len = IOE_BUFFER_SIZE;
+  ioe.ops[op].offset = offset;
+  ioe_prep(IORING_OP_READ, r->fd, r->slot, op, 0);
+  r->ops[i] = op;
+  return 0;
+}
+
+/**
+ * @Brief Start reads into the buffers after head that are idle, in turn, and
+ * submit them in one system call. An owned fd gets a read in every buffer not
+ * lent to the caller; at the current position only one read is in flight.
+ *
+ * @return 0 on success, -1 on error (errno set)
+ */
+static int ioe_fill(IoReader *r)
+{
+  int max = (r->offset >= 0) ? r->num_buffers : 1;
+  int in_flight = 0;
+  for (int i = 0; i < r->num_buffers; i++)
+  {
+    in_flight += r->ops[i] >= 0;
+  }
+  int res = 0;
+  for (int k = r->lent; k < r->num_buffers && in_flight < max && !r->eof; k++)
+  {
+    int i = (r->head + k) % r->num_buffers;
+    if (r->ops[i] >= 0)
+    {
+      continue;
+    }
+    if (ioe_queue_read(r, i, r->offset) != 0)
+    {
+      res = -1;
+      break;
+    }
+    if (r->offset >= 0)
+    {
+      r->offset += IOE_BUFFER_SIZE;
+    }
+    in_flight++;
+  }
+  if (ioe_enter(0) != 0)
+  {
+    res = -1;
+  }
+  return res;
+}
+
+/**
+ * @Brief Wait for every read in flight and drop its data.
+ *
+ * @param cancel 1 to cancel the reads first: at the current position, fd may
+ * be a pipe or tty, where a read can wait forever for data
+ */
+static void ioe_drain(IoReader *r, int cancel)
+{
+  for (int i = 0; i < r->num_buffers; i++)
+  {
+    if (r->ops[i] < 0)
+    {
+      continue;
+    }
+    if (cancel)
+    {
+      ioe_prep_cancel(r->ops[i]);
+      ioe_enter(0);
+    }
+    ioe_wait(r->ops[i]);
+    ioe.ops[r->ops[i]].in_use = 0;
+    r->ops[i] = -1;
+  }
+}
+
+/**
+ * @Brief Get the next chunk read from fd without copying it: the caller scans
+ * the registered buffer itself. The buffer lent by the previous call goes
+ * back to reading ahead first, so the kernel keeps filling the other buffers
+ * while the caller works.
+ *
+ * @param r Pointer to the IoReader, with num_buffers > 0
+ * @param data Set to the chunk, which the caller may modify
+ * @return Length of the chunk, 0 at EOF, -1 on error (errno set)
+ */
+ssize_t ioe_read_chunk(IoReader *r, char **data)
+{
+  if (r->lent)
+  {
+    r->lent = 0;
+    r->head = (r->head + 1) % r->num_buffers;
+  }
+
+  while (1)
+  {
+    // a failed read ahead only matters once its data is needed.
+    if (ioe_fill(r) != 0 && r->ops[r->head] < 0)
+    {
+      return -1;
+    }
+    int op = r->ops[r->head];
+    if (op < 0)
+    {
+      return 0;
+    }
+    ioe_wait(op);
+    int res = ioe.ops[op].res;
+    long long offset = ioe.ops[op].offset;
+    ioe.ops[op].in_use = 0;
+    r->ops[r->head] = -1;
+    if (res == -EINTR || res == -EAGAIN)
+    {
+      // retry at the same offset, ahead of the reads already in flight.
+      if (ioe_queue_read(r, r->head, offset) != 0)
+      {
+        return -1;
+      }
+      continue;
+    }
+    if (res < 0)
+    {
+      r->eof = 1;
+      errno = -res;
+      return -1;
+    }
+    if (res == 0)
+    {
+      r->eof = 1;
+      return 0;
+    }
+    if (r->offset >= 0 && res < IOE_BUFFER_SIZE)
+    {
+      // the reads after a short one started at the wrong offsets.
+      ioe_drain(r, 0);
+      r->offset = offset + res;
+    }
+    r->lent = 1;
+    *data = ioe_buffer_addr(r->buffers[r->head]);
+    ioe_fill(r); // read ahead; a failure resurfaces on a later call.
+    return res;
+  }
+}
+
+/* Cancel any read ahead and release the reader */
+void ioe_reader_close(IoReader *r)
+{
+  ioe_drain(r, r->offset < 0);
+  if (r->slot >= 0)
+  {
+    ioe_unregister_file(r->slot);
+    r->slot = -1;
+  }
+  for (int i = 0; i < r->num_buffers; i++)
+  {
+    ioe.buffer_used[r->buffers[i]] = 0;
+  }
+  r->num_buffers = 0;
+  r->lent = 0;
+}
+
+/***************************************************
+ * Writers
+ ***************************************************/
+
+/* Start writing to fd, at explicit offsets only if fd is owned */
+void ioe_writer_open(IoWriter *w, int fd, int owned)
+{
+  w->fd = fd;
+  w->slot = -1;
+  w->offset = -1;
+  w->buffer = -1;
+  w->num_queued = 0;
+  w->num_ops = 0;
+  w->error = 0;
+  if (ioe_backend() != IOE_URING)
+  {
+    return;
+  }
+  // as for readers: stdout redirected to a file may be shared with
+  // other processes appending to it.
+  w->offset = owned ? ioe_stream_offset(fd) : -1;
+  w->slot = ioe_register_file(fd);
+}
+
+/**
+ * @Brief Wait for the batch in flight and release its buffers. A short write
+ * severs the linked chain and cancels the writes after it, so those are
+ * finished here with write(2), in order.
+ */
+static void ioe_writer_complete(IoWriter *w)
+{
+  for (int i = 0; i < w->num_ops; i++)
+  {
+    ioe_wait(w->ops[i]);
+  }
+  for (int i = 0; i < w->num_ops; i++)
+  {
+    IoOp *o = &ioe.ops[w->ops[i]];
+    if (w->error == 0 && o->res != (int)o->len)
+    {
+      if (o->res < 0 && o->res != -ECANCELED && o->res != -EINTR && o->res != -EAGAIN)
+      {
+        w->error = -o->res;
+      }
+      else
+      {
+        size_t done = (o->res > 0) ? o->res : 0;
+        long long offset = (o->offset >= 0) ? o->offset + (long long)done : -1;
+        if (ioe_write_all(w->fd, ioe_buffer_addr(o->buffer) + done, o->len - done, offset) != 0)
+        {
+          w->error = errno;
+        }
+      }
+    }
+    ioe.buffer_used[o->buffer] = 0;
+    o->in_use = 0;
+  }
+  w->num_ops = 0;
+}
+
+/**
+ * @Brief Submit the queued buffers as one linked chain, so they are written
+ * in order with a single system call. Only one batch per writer is in flight
+ * at a time, which keeps batches in order too.
+ *
+ * @return 0 on success, -1 on error
+ */
+static int ioe_writer_submit(IoWriter *w)
+{
+  ioe_writer_complete(w);
+  if (w->error != 0)
+  {
+    for (int i = 0; i < w->num_queued; i++)
+    {
+      ioe.buffer_used[w->queued[i]] = 0;
+    }
+    w->num_queued = 0;
+    return -1;
+  }
+
+  for (int i = 0; i < w->num_queued; i++)
+  {
+    int op = ioe_get_op();
+    if (op < 0)
+    {
+      // no request slots left: write the rest synchronously, in order.
+      ioe_enter(0);
+      ioe_writer_complete(w);
+      for (int j = i; j < w->num_queued; j++)
+      {
+        if (w->error == 0 &&
+            ioe_write_all(w->fd, ioe_buffer_addr(w->queued[j]), w->queued_len[j], w->offset) != 0)
+        {
+          w->error = errno;
+        }
+        if (w->offset >= 0)
+        {
+          w->offset += w->queued_len[j];
+        }
+        ioe.buffer_used[w->queued[j]] = 0;
+      }
+      w->num_queued = 0;
+      return w->error == 0 ? 0 : -1;
+    }
+    ioe.ops[op].buffer = w->queued[i];
+    ioe.ops[op].len = w->queued_len[i];
+    ioe.ops[op].offset = w->offset;
+    if (w->offset >= 0)
+    {
+      w->offset += w->queued_len[i];
+    }
+    ioe_prep(IORING_OP_WRITE, w->fd, w->slot, op, (i < w->num_queued - 1) ? IOSQE_IO_LINK : 0);
+    w->ops[w->num_ops++] = op;
+  }
+  w->num_queued = 0;
+
+  if (ioe_enter(0) != 0)
+  {
+    w->error = errno;
+    return -1;
+  }
+  return 0;
+}
+
+/* Buffer to fill next, NULL if the writer must fall back to write(2) */
+char *ioe_writer_buf(IoWriter *w, size_t *capacity)
+{
+  if (ioe_backend() != IOE_URING || w->error != 0)
+  {
+    return NULL;
+  }
+  if (w->buffer < 0)
+  {
+    w->buffer = ioe_get_buffer();
+  }
+  if (w->buffer < 0 && (w->num_ops > 0 || w->num_queued > 0))
+  {
+    // reuse this writer's own buffers once they are written out.
+    ioe_writer_flush(w);
+    w->buffer = ioe_get_buffer();
+  }
+  if (w->buffer < 0)
+  {
+    // everything queued so far is written, so write(2) keeps the order.
+    ioe_writer_flush(w);
+    return NULL;
+  }
+  *capacity = IOE_BUFFER_SIZE;
+  return ioe_buffer_addr(w->buffer);
+}
+
+/* Queue the first len bytes of the current buffer for writing */
+int ioe_writer_commit(IoWriter *w, size_t len)
+{
+  if (w->buffer < 0 || len == 0)
+  {
+    return w->error == 0 ? 0 : -1;
+  }
+  w->queued[w->num_queued] = w->buffer;
+  w->queued_len[w->num_queued] = len;
+  w->num_queued++;
+  w->buffer = -1;
+  if (w->num_queued == IOE_WRITE_BATCH)
+  {
+    return ioe_writer_submit(w);
+  }
+  return w->error == 0 ? 0 : -1;
+}
+
+/* Submit every queued write and wait for all of them */
+int ioe_writer_flush(IoWriter *w)
+{
+  if (w->num_queued > 0)
+  {
+    ioe_writer_submit(w);
+  }
+  ioe_writer_complete(w);
+  return w->error == 0 ? 0 : -1;
+}
+
+/* Flush and release the writer */
+int ioe_writer_close(IoWriter *w)
+{
+  if (ioe_backend() != IOE_URING)
+  {
+    return w->error == 0 ? 0 : -1;
+  }
+  ioe_writer_flush(w);
+  if (w->buffer >= 0)
+  {
+    ioe.buffer_used[w->buffer] = 0;
+    w->buffer = -1;
+  }
+  if (w->slot >= 0)
+  {
+    ioe_unregister_file(w->slot);
+    w->slot = -1;
+  }
+  return w->error == 0 ? 0 : -1;
+}
@@ -0,0 +1,86 @@
+#ifndef IO_ENGINE_H
+#define IO_ENGINE_H
+
+#include <sys/types.h>
+
+#define IOE_QUEUE_DEPTH 64          // submission queue entries
+#define IOE_NUM_BUFFERS 32          // registered buffers shared by all streams
+#define IOE_BUFFER_SIZE (64 * 1024) // size of each registered buffer
+#define IOE_MAX_FILES 64            // registered file slots
+#define IOE_WRITE_BATCH 4           // writes submitted together as one linked chain
+#define IOE_READ_AHEAD 4            // most buffers a reader of an owned fd cycles through
+
+typedef enum {
+    IOE_SYNC,  // plain read(2)/write(2)
+    IOE_URING  // io_uring with registered buffers and files
+} IoBackend;
+
+// Reads from one fd into registered buffers used in turn: one is lent to
+// the caller while reads ahead fill the others
+typedef struct {
+    int fd;
+    int slot;           // registered file slot, -1 if not registered
+    long long offset;   // offset of the next read to start, -1 for the current position
+    int buffers[IOE_READ_AHEAD];
+    int ops[IOE_READ_AHEAD]; // read in flight into each buffer, -1 if none
+    int num_buffers;    // 0 if the reader must fall back to read(2)
+    int head;           // buffer with the oldest data
+    int lent;           // 1 if buffers[head] is lent to the caller
+    int eof;
+} IoReader;
+
+// Writes to one fd through registered buffers, in submission order
+typedef struct {
+    int fd;
+    int slot;
+    long long offset;   // next offset to write at, -1 for the current position
+    int buffer;         // buffer being filled, -1 if none
+    int queued[IOE_WRITE_BATCH];       // filled buffers not yet submitted
+    size_t queued_len[IOE_WRITE_BATCH];
+    int num_queued;
+    int ops[IOE_WRITE_BATCH];          // the batch in flight, in order
+    int num_ops;
+    int error;          // errno of a failed write, 0 if none
+} IoWriter;
+
+// Backend in use by this process. Sets up io_uring on first call, unless
+// it is unavailable or WSH_IO=sync
+IoBackend ioe_backend(void);
+
+// Start reading from fd. owned is 1 if fd is a regular file no other process
+// uses (eg: a temp file), so reads can be issued at explicit offsets; other
+// fds are read at their current position, which they may share with others
+void ioe_reader_open(IoReader *r, int fd, int owned);
+
+// Set *data to the next chunk read, in one of the reader's buffers. It may be
+// modified and stays valid until the next call. Only for readers with
+// num_buffers > 0. Returns its length, 0 at EOF, -1 on error (errno set)
+ssize_t ioe_read_chunk(IoReader *r, char **data);
+
+// Cancel any read ahead. Bytes read ahead are consumed, as with a pipe,
+// and the position of an owned fd is left as it was
+void ioe_reader_close(IoReader *r);
+
+// Start writing to fd. owned is as for ioe_reader_open(): only owned fds
+// are written at explicit offsets, which leaves their position untouched
+void ioe_writer_open(IoWriter *w, int fd, int owned);
+
+// Buffer to fill before ioe_writer_commit(), with its capacity.
+// NULL if the writer must fall back to write(2)
+char *ioe_writer_buf(IoWriter *w, size_t *capacity);
+
+// Queue the first len bytes of the current buffer for writing.
+// Returns 0 on success, -1 on error
+int ioe_writer_commit(IoWriter *w, size_t len);
+
+// Submit every queued write and wait for all of them.
+// Returns 0 on success, -1 on error
+int ioe_writer_flush(IoWriter *w);
+
+// Flush and release the writer. Returns 0 on success, -1 on error
+int ioe_writer_close(IoWriter *w);
+
+// Tear down the ring and free the buffers
+void ioe_shutdown(void);
+
+#endif // IO_ENGINE_H
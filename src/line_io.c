@@ -0,0 +1,319 @@
+#include "line_io.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static char *lio_alloc(size_t size)
+{
+  char *buf = malloc(size);
+  if (buf == NULL)
+  {
+    perror("malloc");
+    exit(-1);
+  }
+  return buf;
+}
+
+/* Start reading lines from fd */
+void lr_init(LineReader *lr, int fd, int owned)
+{
+  lr->fd = fd;
+  lr->buf = lio_alloc(LINE_IO_BUFSIZE);
+  lr->capacity = LINE_IO_BUFSIZE;
+  lr->start = 0;
+  lr->end = 0;
+  lr->eof = 0;
+  lr->error = 0;
+  lr->chunk = NULL;
+  lr->chunk_start = 0;
+  lr->chunk_end = 0;
+  ioe_reader_open(&lr->io, fd, owned);
+}
+
+/**
+ * @Brief Make room for at least len more bytes after lr->end, first by
+ * dropping the bytes already returned, then by doubling the buffer.
+ */
+static void lr_make_room(LineReader *lr, size_t len)
+{
+  if (lr->start > 0)
+  {
+    memmove(lr->buf, lr->buf + lr->start, lr->end - lr->start);
+    lr->end -= lr->start;
+    lr->start = 0;
+  }
+  if (lr->capacity - lr->end < len)
+  {
+    while (lr->capacity - lr->end < len)
+    {
+      lr->capacity *= 2;
+    }
+    lr->buf = realloc(lr->buf, lr->capacity);
+    if (lr->buf == NULL)
+    {
+      perror("realloc");
+      exit(-1);
+    }
+  }
+}
+
+/* Append len bytes of the current chunk to the partial line in buf */
+static void lr_keep(LineReader *lr, size_t len)
+{
+  lr_make_room(lr, len + 1);
+  memcpy(lr->buf + lr->end, lr->chunk + lr->chunk_start, len);
+  lr->end += len;
+  lr->chunk_start += len;
+}
+
+/**
+ * @Brief Read the next chunk, into buf with read(2) or lent by the io engine.
+ *
+ * @return 0 on success or at EOF (lr->eof is set), -1 on error (lr->error is set)
+ */
+static int lr_fill(LineReader *lr)
+{
+  ssize_t n;
+  do
+  {
+    if (lr->io.num_buffers > 0)
+    {
+      n = ioe_read_chunk(&lr->io, &lr->chunk);
+      lr->chunk_start = 0;
+      lr->chunk_end = (n > 0) ? n : 0;
+    }
+    else
+    {
+      if (lr->end == lr->capacity)
+      {
+        lr_make_room(lr, 1);
+      }
+      n = read(lr->fd, lr->buf + lr->end, lr->capacity - lr->end);
+      lr->end += (n > 0) ? n : 0;
+    }
+  } while (n < 0 && errno == EINTR);
+
+  if (n < 0)
+  {
+    lr->error = errno;
+    return -1;
+  }
+  if (n == 0)
+  {
+    lr->chunk = NULL;
+    lr->eof = 1;
+  }
+  return 0;
+}
+
+/**
+ * @Brief Read the next line
+ *
+ * @param lr Pointer to the LineReader
+ * @param line Set to the NUL-terminated line (without its newline)
+ * @return Length of the line, -1 at EOF or on error (lr->error is set)
+ */
+ssize_t lr_next(LineReader *lr, char **line)
+{
+  while (1)
+  {
+    if (lr->chunk != NULL)
+    {
+      char *start = lr->chunk + lr->chunk_start;
+      char *newline = memchr(start, '\n', lr->chunk_end - lr->chunk_start);
+      if (newline == NULL)
+      {
+        // the chunk is recycled by the next read: keep its tail.
+        lr_keep(lr, lr->chunk_end - lr->chunk_start);
+        lr->chunk = NULL;
+      }
+      else if (lr->start == lr->end)
+      {
+        *newline = '\0';
+        *line = start;
+        lr->chunk_start = newline - lr->chunk + 1;
+        return newline - start;
+      }
+      else
+      {
+        // the line started in an earlier chunk: complete it in buf.
+        lr_keep(lr, newline - start);
+        lr->chunk_start++;
+        lr->buf[lr->end] = '\0';
+        *line = lr->buf + lr->start;
+        ssize_t len = lr->end - lr->start;
+        lr->start = lr->end;
+        return len;
+      }
+    }
+    else
+    {
+      char *start = lr->buf + lr->start;
+      char *newline = memchr(start, '\n', lr->end - lr->start);
+      if (newline != NULL)
+      {
+        *newline = '\0';
+        *line = start;
+        lr->start = newline - lr->buf + 1;
+        return newline - start;
+      }
+    }
+
+    if (lr->eof)
+    {
+      if (lr->start == lr->end)
+      {
+        return -1;
+      }
+      // last line has no newline: terminate it in place.
+      if (lr->end == lr->capacity)
+      {
+        lr_make_room(lr, 1);
+      }
+      lr->buf[lr->end] = '\0';
+      *line = lr->buf + lr->start;
+      ssize_t len = lr->end - lr->start;
+      lr->start = lr->end;
+      return len;
+    }
+
+    if (lr_fill(lr) != 0)
+    {
+      return -1;
+    }
+  }
+}
+
+/* Free the reader's buffer */
+void lr_free(LineReader *lr)
+{
+  ioe_reader_close(&lr->io);
+  free(lr->buf);
+  lr->buf = NULL;
+}
+
+/* Start writing to fd, filling io engine buffers when there are any */
+void lw_init(LineWriter *lw, int fd, int owned)
+{
+  lw->fd = fd;
+  lw->len = 0;
+  lw->error = 0;
+  ioe_writer_open(&lw->io, fd, owned);
+  lw->buf = ioe_writer_buf(&lw->io, &lw->capacity);
+  lw->engine = lw->buf != NULL;
+  if (!lw->engine)
+  {
+    lw->buf = lio_alloc(LINE_IO_BUFSIZE);
+    lw->capacity = LINE_IO_BUFSIZE;
+  }
+}
+
+/**
+ * @Brief Hand the buffered bytes off for writing. With the io engine the
+ * write is only queued and a fresh buffer is taken, without waiting.
+ */
+static int lw_drain(LineWriter *lw)
+{
+  if (lw->engine)
+  {
+    if (ioe_writer_commit(&lw->io, lw->len) != 0)
+    {
+      lw->error = lw->io.error;
+    }
+    lw->len = 0;
+    char *buf = ioe_writer_buf(&lw->io, &lw->capacity);
+    if (buf == NULL)
+    {
+      // out of engine buffers (and all queued data written): use write(2).
+      lw->engine = 0;
+      lw->buf = lio_alloc(LINE_IO_BUFSIZE);
+      lw->capacity = LINE_IO_BUFSIZE;
+      if (lw->io.error != 0)
+      {
+        lw->error = lw->io.error;
+      }
+    }
+    else
+    {
+      lw->buf = buf;
+    }
+    return lw->error == 0 ? 0 : -1;
+  }
+
+  size_t done = 0;
+  while (done < lw->len && lw->error == 0)
+  {
+    ssize_t n = write(lw->fd, lw->buf + done, lw->len - done);
+    if (n < 0)
+    {
+      if (errno != EINTR)
+      {
+        lw->error = errno;
+      }
+      continue;
+    }
+    done += n;
+  }
+  lw->len = 0;
+  return lw->error == 0 ? 0 : -1;
+}
+
+/* Write out everything buffered */
+int lw_flush(LineWriter *lw)
+{
+  lw_drain(lw);
+  if (lw->engine && ioe_writer_flush(&lw->io) != 0 && lw->error == 0)
+  {
+    lw->error = lw->io.error;
+  }
+  return lw->error == 0 ? 0 : -1;
+}
+
+/* Buffer len bytes of data, flushing when the buffer fills up */
+int lw_write(LineWriter *lw, const char *data, size_t len)
+{
+  while (len > 0 && lw->error == 0)
+  {
+    if (lw->len == lw->capacity && lw_drain(lw) != 0)
+    {
+      break;
+    }
+    size_t chunk = lw->capacity - lw->len;
+    if (chunk > len)
+    {
+      chunk = len;
+    }
+    memcpy(lw->buf + lw->len, data, chunk);
+    lw->len += chunk;
+    data += chunk;
+    len -= chunk;
+  }
+  return lw->error == 0 ? 0 : -1;
+}
+
+/* Buffer a line followed by '\n' */
+int lw_line(LineWriter *lw, const char *line, size_t len)
+{
+  lw_write(lw, line, len);
+  return lw_write(lw, "\n", 1);
+}
+
+/* Flush and free the writer's buffer */
+int lw_free(LineWriter *lw)
+{
+  int res = lw_flush(lw);
+  if (ioe_writer_close(&lw->io) != 0 && res == 0)
+  {
+    lw->error = lw->io.error;
+    res = -1;
+  }
+  if (!lw->engine)
+  {
+    free(lw->buf);
+  }
+  lw->buf = NULL;
+  return res;
+}
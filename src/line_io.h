@@ -0,0 +1,62 @@
+#ifndef LINE_IO_H
+#define LINE_IO_H
+
+#include <sys/types.h>
+
+#include "io_engine.h"
+
+#define LINE_IO_BUFSIZE (64 * 1024) // initial buffer size for readers and writers
+
+// Buffered reader that splits a file descriptor into lines
+typedef struct {
+    int fd;
+    char *buf;
+    size_t capacity;
+    size_t start; // first byte not yet returned
+    size_t end;   // one past the last byte read
+    int eof;
+    int error;    // errno of a failed read, 0 if none
+    IoReader io;
+    char *chunk;  // chunk lent by the io engine, NULL if none: lines are
+                  // returned from it in place, buf only holds one that
+                  // continues into the next chunk
+    size_t chunk_start, chunk_end;
+} LineReader;
+
+// Buffered writer to a file descriptor
+typedef struct {
+    int fd;
+    char *buf;
+    size_t len;
+    size_t capacity;
+    int error;    // errno of a failed write, 0 if none
+    int engine;   // 1 if buf is an io engine buffer, 0 if it is our own
+    IoWriter io;
+} LineWriter;
+
+// Start reading lines from fd (owned: see ioe_reader_open())
+void lr_init(LineReader *lr, int fd, int owned);
+
+// Read the next line. The newline is replaced by '\0' in place and *line stays
+// valid until the next call. Returns the line length, -1 at EOF or on error
+ssize_t lr_next(LineReader *lr, char **line);
+
+// Free the reader's buffer (does not close fd)
+void lr_free(LineReader *lr);
+
+// Start writing to fd (owned: see ioe_writer_open())
+void lw_init(LineWriter *lw, int fd, int owned);
+
+// Buffer len bytes of data. Returns 0 on success, -1 on error
+int lw_write(LineWriter *lw, const char *data, size_t len);
+
+// Buffer a line followed by '\n'. Returns 0 on success, -1 on error
+int lw_line(LineWriter *lw, const char *line, size_t len);
+
+// Write out everything buffered. Returns 0 on success, -1 on error
+int lw_flush(LineWriter *lw);
+
+// Flush and free the writer's buffer (does not close fd)
+int lw_free(LineWriter *lw);
+
+#endif // LINE_IO_H
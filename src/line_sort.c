@@ -0,0 +1,683 @@
+#define _GNU_SOURCE
+#include "line_sort.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "line_io.h"
+
+// A line and its precomputed numeric key (only used with opts->numeric)
+typedef struct {
+  char *ptr; // NUL-terminated, without the newline
+  size_t len;
+  double key;
+} SortLine;
+
+// Lines held in memory: bytes live in one arena, the index points into it
+typedef struct {
+  char *arena;
+  size_t arena_used;
+  size_t arena_cap;
+  SortLine *lines;
+  size_t num_lines;
+  size_t lines_cap;
+} SortBuffer;
+
+// Open, unlinked temp files holding sorted runs, in input order
+typedef struct {
+  int *fds;
+  size_t size;
+  size_t capacity;
+} RunList;
+
+// One unit of work for a sorting thread. With dst == NULL, sort
+// src[lo, hi) in place; otherwise merge src[lo, mid) and src[mid, hi)
+// into dst[lo, hi).
+typedef struct {
+  SortLine *src;
+  SortLine *dst;
+  size_t lo, mid, hi;
+  const SortOptions *opts;
+} SortTask;
+
+// A spilled run being merged, and its current line
+typedef struct {
+  LineReader reader;
+  SortLine line;
+} MergeSource;
+
+/* Fill opts with the defaults */
+void sort_default_options(SortOptions *opts)
+{
+  opts->reverse = 0;
+  opts->numeric = 0;
+  opts->mem_limit = SORT_DEFAULT_MEM;
+  opts->threads = 0;
+}
+
+/**
+ * @Brief Leading number of a line, as `sort -n` sees it: optional blanks,
+ * an optional minus sign, then digits with an optional decimal point.
+ * Lines that don't start with a number count as 0.
+ */
+static double numeric_key(const char *s)
+{
+  while (isblank((unsigned char)*s))
+  {
+    s++;
+  }
+  const char *p = (*s == '-') ? s + 1 : s;
+  if (!isdigit((unsigned char)*p) && !(*p == '.' && isdigit((unsigned char)p[1])))
+  {
+    return 0;
+  }
+  // strtod() would also take hex and exponents ("0x1f", "1e5"): cut the
+  // number off where `sort -n` stops reading it.
+  const char *end = p + strspn(p, "0123456789");
+  if (*end == '.')
+  {
+    end += 1 + strspn(end + 1, "0123456789");
+  }
+  size_t len = end - s;
+  char buf[64];
+  char *num = len < sizeof(buf) ? buf : malloc(len + 1);
+  if (num == NULL)
+  {
+    return strtod(s, NULL);
+  }
+  memcpy(num, s, len);
+  num[len] = '\0';
+  double key = strtod(num, NULL);
+  if (num != buf)
+  {
+    free(num);
+  }
+  return key;
+}
+
+/**
+ * @Brief Compare two lines: by numeric key first (with -n),
+ * then byte by byte, shorter line first on a tie.
+ */
+static int compare_lines(const SortLine *a, const SortLine *b, const SortOptions *opts)
+{
+  int res = 0;
+  if (opts->numeric)
+  {
+    res = (a->key > b->key) - (a->key < b->key);
+  }
+  if (res == 0)
+  {
+    size_t n = a->len < b->len ? a->len : b->len;
+    res = memcmp(a->ptr, b->ptr, n);
+    res = (res > 0) - (res < 0);
+    if (res == 0)
+    {
+      res = (a->len > b->len) - (a->len < b->len);
+    }
+  }
+  return opts->reverse ? -res : res;
+}
+
+static int qsort_compare(const void *a, const void *b, void *opts)
+{
+  return compare_lines(a, b, opts);
+}
+
+static void *run_sort_task(void *arg)
+{
+  SortTask *t = arg;
+  if (t->dst == NULL)
+  {
+    qsort_r(t->src + t->lo, t->hi - t->lo, sizeof(SortLine), qsort_compare, (void *)t->opts);
+    return NULL;
+  }
+
+  size_t i = t->lo, j = t->mid, k = t->lo;
+  while (i < t->mid && j < t->hi)
+  {
+    // take from the left run on ties to keep the sort stable.
+    if (compare_lines(&t->src[j], &t->src[i], t->opts) < 0)
+    {
+      t->dst[k++] = t->src[j++];
+    }
+    else
+    {
+      t->dst[k++] = t->src[i++];
+    }
+  }
+  memcpy(t->dst + k, t->src + i, (t->mid - i) * sizeof(SortLine));
+  k += t->mid - i;
+  memcpy(t->dst + k, t->src + j, (t->hi - j) * sizeof(SortLine));
+  return NULL;
+}
+
+/**
+ * @Brief Run tasks concurrently, one thread each (the first on the calling
+ * thread). A task whose thread can't be created runs inline instead.
+ */
+static void run_tasks(SortTask *tasks, size_t num_tasks)
+{
+  pthread_t tids[SORT_MAX_THREADS];
+  int started[SORT_MAX_THREADS] = {0};
+  for (size_t i = 1; i < num_tasks; i++)
+  {
+    started[i] = pthread_create(&tids[i], NULL, run_sort_task, &tasks[i]) == 0;
+    if (!started[i])
+    {
+      run_sort_task(&tasks[i]);
+    }
+  }
+  run_sort_task(&tasks[0]);
+  for (size_t i = 1; i < num_tasks; i++)
+  {
+    if (started[i])
+    {
+      pthread_join(tids[i], NULL);
+    }
+  }
+}
+
+/**
+ * @Brief Parallel merge sort: each thread sorts one slice, then slices are
+ * merged pairwise (pairs in parallel) until one run is left.
+ *
+ * @param lines The lines to sort in place
+ * @param n Number of lines
+ * @param opts Sort options (opts->threads already resolved)
+ * @return 0 on success, -1 if the scratch index can't be allocated
+ */
+static int sort_lines(SortLine *lines, size_t n, const SortOptions *opts)
+{
+  size_t threads = opts->threads;
+  if (n < SORT_MIN_PARALLEL)
+  {
+    threads = 1;
+  }
+
+  size_t bounds[SORT_MAX_THREADS + 1];
+  SortTask tasks[SORT_MAX_THREADS];
+  for (size_t i = 0; i <= threads; i++)
+  {
+    bounds[i] = n * i / threads;
+  }
+  for (size_t i = 0; i < threads; i++)
+  {
+    tasks[i] = (SortTask){lines, NULL, bounds[i], bounds[i + 1], bounds[i + 1], opts};
+  }
+  if (threads == 1)
+  {
+    run_tasks(tasks, threads);
+    return 0;
+  }
+  // allocate the scratch copy before sorting, so a failure leaves lines as they were.
+  SortLine *tmp = malloc(n * sizeof(SortLine));
+  if (tmp == NULL)
+  {
+    return -1;
+  }
+  run_tasks(tasks, threads);
+
+  SortLine *src = lines, *dst = tmp;
+  size_t runs = threads;
+  while (runs > 1)
+  {
+    size_t num_tasks = 0;
+    for (size_t i = 0; i < runs; i += 2)
+    {
+      // an odd run out is "merged" with an empty one, i.e. copied.
+      size_t hi = (i + 2 <= runs) ? bounds[i + 2] : bounds[i + 1];
+      tasks[num_tasks] = (SortTask){src, dst, bounds[i], bounds[i + 1], hi, opts};
+      bounds[++num_tasks] = hi;
+    }
+    run_tasks(tasks, num_tasks);
+    runs = num_tasks;
+    SortLine *swap = src;
+    src = dst;
+    dst = swap;
+  }
+
+  if (src != lines)
+  {
+    memcpy(lines, src, n * sizeof(SortLine));
+  }
+  free(tmp);
+  return 0;
+}
+
+/**
+ * @Brief Create an anonymous temp file for a run in $TMPDIR (or /tmp).
+ * The file is unlinked right away, so it vanishes when closed.
+ *
+ * @return The file descriptor, -1 on error
+ */
+static int make_temp_fd(void)
+{
+  const char *dir = getenv("TMPDIR");
+  if (dir == NULL || *dir == '\0')
+  {
+    dir = "/tmp";
+  }
+  char *path;
+  if (asprintf(&path, "%s/wsh-sort-XXXXXX", dir) < 0)
+  {
+    return -1;
+  }
+  int fd = mkstemp(path);
+  if (fd >= 0)
+  {
+    unlink(path);
+  }
+  free(path);
+  return fd;
+}
+
+/**
+ * @Brief Write lines (one per line) to fd
+ *
+ * @param owned 1 if fd is one of our temp files (see ioe_writer_open())
+ * @return 0 on success, -1 on error
+ */
+static int write_lines(const SortLine *lines, size_t n, int fd, int owned)
+{
+  LineWriter lw;
+  lw_init(&lw, fd, owned);
+  for (size_t i = 0; i < n; i++)
+  {
+    lw_line(&lw, lines[i].ptr, lines[i].len);
+  }
+  int err = lw.error;
+  if (lw_free(&lw) != 0)
+  {
+    errno = err != 0 ? err : lw.error;
+    return -1;
+  }
+  return 0;
+}
+
+/* Add a run to the list. Returns 0 on success, -1 if out of memory */
+static int runs_push(RunList *runs, int fd)
+{
+  if (runs->size == runs->capacity)
+  {
+    size_t capacity = (runs->capacity == 0) ? 8 : runs->capacity * 2;
+    int *fds = realloc(runs->fds, capacity * sizeof(int));
+    if (fds == NULL)
+    {
+      return -1;
+    }
+    runs->fds = fds;
+    runs->capacity = capacity;
+  }
+  runs->fds[runs->size++] = fd;
+  return 0;
+}
+
+/**
+ * @Brief Sort the buffered lines, write them to a new temp file
+ * and empty the buffer.
+ *
+ * @return 0 on success, -1 on error
+ */
+static int spill_run(SortBuffer *sb, RunList *runs, const SortOptions *opts)
+{
+  if (sort_lines(sb->lines, sb->num_lines, opts) != 0)
+  {
+    return -1;
+  }
+  int fd = make_temp_fd();
+  if (fd < 0)
+  {
+    return -1;
+  }
+  if (write_lines(sb->lines, sb->num_lines, fd, 1) != 0 || lseek(fd, 0, SEEK_SET) < 0 ||
+      runs_push(runs, fd) != 0)
+  {
+    int err = errno;
+    close(fd);
+    errno = err;
+    return -1;
+  }
+  sb->arena_used = 0;
+  sb->num_lines = 0;
+  return 0;
+}
+
+/* 1 if a line of len bytes fits in the buffer without passing the budget */
+static int sb_fits(const SortBuffer *sb, size_t len, const SortOptions *opts)
+{
+  // the index is counted twice: sort_lines() needs a same-sized scratch copy.
+  size_t need = sb->arena_used + len + 1 + (sb->num_lines + 1) * 2 * sizeof(SortLine);
+  return sb->num_lines == 0 || need <= opts->mem_limit;
+}
+
+/**
+ * @Brief Grow the arena to hold at least need bytes. It doubles, but not past
+ * the memory budget unless a single line needs more.
+ * The indexed lines are moved over to the new arena.
+ *
+ * @return 0 on success, -1 if out of memory
+ */
+static int sb_grow_arena(SortBuffer *sb, size_t need, const SortOptions *opts)
+{
+  size_t cap = (sb->arena_cap == 0) ? LINE_IO_BUFSIZE : sb->arena_cap;
+  while (cap < need && cap < opts->mem_limit)
+  {
+    cap *= 2;
+  }
+  if (cap > opts->mem_limit)
+  {
+    cap = opts->mem_limit;
+  }
+  if (cap < need)
+  {
+    cap = need;
+  }
+
+  char *arena = malloc(cap);
+  if (arena == NULL)
+  {
+    return -1;
+  }
+  if (sb->arena_used > 0)
+  {
+    memcpy(arena, sb->arena, sb->arena_used);
+  }
+  for (size_t i = 0; i < sb->num_lines; i++)
+  {
+    sb->lines[i].ptr = arena + (sb->lines[i].ptr - sb->arena);
+  }
+  free(sb->arena);
+  sb->arena = arena;
+  sb->arena_cap = cap;
+  return 0;
+}
+
+/**
+ * @Brief Copy a line into the arena and add it to the index
+ *
+ * @return 0 on success, -1 if out of memory
+ */
+static int sb_add(SortBuffer *sb, const char *line, size_t len, const SortOptions *opts)
+{
+  if (sb->arena_used + len + 1 > sb->arena_cap &&
+      sb_grow_arena(sb, sb->arena_used + len + 1, opts) != 0)
+  {
+    return -1;
+  }
+  if (sb->num_lines == sb->lines_cap)
+  {
+    size_t lines_cap = (sb->lines_cap == 0) ? 1024 : sb->lines_cap * 2;
+    SortLine *lines = realloc(sb->lines, lines_cap * sizeof(SortLine));
+    if (lines == NULL)
+    {
+      return -1;
+    }
+    sb->lines = lines;
+    sb->lines_cap = lines_cap;
+  }
+
+  char *dst = sb->arena + sb->arena_used;
+  memcpy(dst, line, len + 1);
+  sb->arena_used += len + 1;
+  sb->lines[sb->num_lines++] = (SortLine){dst, len, opts->numeric ? numeric_key(dst) : 0};
+  return 0;
+}
+
+/* Load the next line of a merge source. Returns 1 if there was one */
+static int merge_advance(MergeSource *s, const SortOptions *opts)
+{
+  ssize_t len = lr_next(&s->reader, &s->line.ptr);
+  if (len < 0)
+  {
+    return 0;
+  }
+  s->line.len = len;
+  s->line.key = opts->numeric ? numeric_key(s->line.ptr) : 0;
+  return 1;
+}
+
+/* Heap order: smallest line first, earlier run first on a tie */
+static int merge_less(const MergeSource *src, size_t a, size_t b, const SortOptions *opts)
+{
+  int res = compare_lines(&src[a].line, &src[b].line, opts);
+  return res < 0 || (res == 0 && a < b);
+}
+
+static void heap_sift_down(size_t *heap, size_t size, const MergeSource *src, const SortOptions *opts)
+{
+  size_t i = 0;
+  while (1)
+  {
+    size_t smallest = i;
+    size_t left = 2 * i + 1, right = 2 * i + 2;
+    if (left < size && merge_less(src, heap[left], heap[smallest], opts))
+    {
+      smallest = left;
+    }
+    if (right < size && merge_less(src, heap[right], heap[smallest], opts))
+    {
+      smallest = right;
+    }
+    if (smallest == i)
+    {
+      return;
+    }
+    size_t swap = heap[i];
+    heap[i] = heap[smallest];
+    heap[smallest] = swap;
+    i = smallest;
+  }
+}
+
+/**
+ * @Brief k-way merge of sorted runs into out_fd using a binary heap.
+ *
+ * @param out_owned 1 if out_fd is one of our temp files
+ * @return 0 on success, -1 on error
+ */
+static int merge_runs(const int *fds, size_t n, int out_fd, int out_owned, const SortOptions *opts)
+{
+  MergeSource *src = malloc(n * sizeof(MergeSource));
+  size_t *heap = malloc(n * sizeof(size_t));
+  if (src == NULL || heap == NULL)
+  {
+    free(src);
+    free(heap);
+    errno = ENOMEM;
+    return -1;
+  }
+  size_t heap_size = 0;
+
+  for (size_t i = 0; i < n; i++)
+  {
+    lr_init(&src[i].reader, fds[i], 1);
+    if (merge_advance(&src[i], opts))
+    {
+      // sift up
+      size_t j = heap_size++;
+      heap[j] = i;
+      while (j > 0 && merge_less(src, heap[j], heap[(j - 1) / 2], opts))
+      {
+        size_t parent = (j - 1) / 2;
+        size_t swap = heap[j];
+        heap[j] = heap[parent];
+        heap[parent] = swap;
+        j = parent;
+      }
+    }
+  }
+
+  LineWriter lw;
+  lw_init(&lw, out_fd, out_owned);
+  while (heap_size > 0 && lw.error == 0)
+  {
+    MergeSource *top = &src[heap[0]];
+    lw_line(&lw, top->line.ptr, top->line.len);
+    if (!merge_advance(top, opts))
+    {
+      heap[0] = heap[--heap_size];
+    }
+    heap_sift_down(heap, heap_size, src, opts);
+  }
+
+  int err = lw.error;
+  if (lw_free(&lw) != 0 && err == 0)
+  {
+    err = lw.error;
+  }
+  for (size_t i = 0; i < n; i++)
+  {
+    if (err == 0 && src[i].reader.error != 0)
+    {
+      err = src[i].reader.error;
+    }
+    lr_free(&src[i].reader);
+  }
+  free(src);
+  free(heap);
+  errno = err;
+  return err == 0 ? 0 : -1;
+}
+
+/**
+ * @Brief Merge every spilled run into out_fd. When there are more runs than
+ * SORT_MERGE_FANIN, the first ones are merged into a new run first.
+ *
+ * @return 0 on success, -1 on error
+ */
+static int merge_all_runs(RunList *runs, int out_fd, const SortOptions *opts)
+{
+  while (runs->size > SORT_MERGE_FANIN)
+  {
+    int fd = make_temp_fd();
+    if (fd < 0)
+    {
+      return -1;
+    }
+    if (merge_runs(runs->fds, SORT_MERGE_FANIN, fd, 1, opts) != 0 || lseek(fd, 0, SEEK_SET) < 0)
+    {
+      int err = errno;
+      close(fd);
+      errno = err;
+      return -1;
+    }
+    for (size_t i = 0; i < SORT_MERGE_FANIN; i++)
+    {
+      close(runs->fds[i]);
+    }
+    // the merged run replaces the runs it came from, keeping input order.
+    runs->fds[0] = fd;
+    memmove(runs->fds + 1, runs->fds + SORT_MERGE_FANIN,
+            (runs->size - SORT_MERGE_FANIN) * sizeof(int));
+    runs->size -= SORT_MERGE_FANIN - 1;
+  }
+  return merge_runs(runs->fds, runs->size, out_fd, 0, opts);
+}
+
+/**
+ * @Brief Sort lines from in_fds into out_fd. Lines are buffered in an arena
+ * until opts->mem_limit is reached, at which point the buffer is sorted and
+ * spilled to a temp file. Spilled runs are then k-way merged.
+ *
+ * @param in_fds Input file descriptors, read in order. Any but stdin are
+ * opened for this sort only, and read ahead at explicit offsets
+ * @param num_in Number of input file descriptors
+ * @param out_fd Where to write the sorted lines
+ * @param opts Sort options
+ * @return 0 on success, -1 on error (errno is set)
+ */
+int sort_fds(const int *in_fds, size_t num_in, int out_fd, const SortOptions *opts)
+{
+  SortOptions o = *opts;
+  if (o.threads <= 0)
+  {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    o.threads = cpus > 0 ? (int)cpus : 1;
+  }
+  if (o.threads > SORT_MAX_THREADS)
+  {
+    o.threads = SORT_MAX_THREADS;
+  }
+  if (o.mem_limit < SORT_MIN_MEM)
+  {
+    o.mem_limit = SORT_MIN_MEM;
+  }
+
+  // no point buffering more than fits in RAM: past that, spilling is faster.
+  long pages = sysconf(_SC_PHYS_PAGES);
+  long page_size = sysconf(_SC_PAGESIZE);
+  if (pages > 0 && page_size > 0 && o.mem_limit / page_size > (size_t)pages)
+  {
+    o.mem_limit = (size_t)pages * page_size;
+  }
+
+  // The arena starts small and grows with the input, up to o.mem_limit.
+  SortBuffer sb = {NULL, 0, 0, NULL, 0, 0};
+  RunList runs = {NULL, 0, 0};
+  int res = 0;
+  int err = 0;
+
+  for (size_t i = 0; i < num_in && res == 0; i++)
+  {
+    LineReader lr;
+    lr_init(&lr, in_fds[i], in_fds[i] != STDIN_FILENO);
+    char *line;
+    ssize_t len;
+    while ((len = lr_next(&lr, &line)) >= 0)
+    {
+      if ((!sb_fits(&sb, len, &o) && spill_run(&sb, &runs, &o) != 0) ||
+          sb_add(&sb, line, len, &o) != 0)
+      {
+        res = -1;
+        err = errno;
+        break;
+      }
+    }
+    if (res == 0 && lr.error != 0)
+    {
+      res = -1;
+      err = lr.error;
+    }
+    lr_free(&lr);
+  }
+
+  if (res == 0 && runs.size == 0)
+  {
+    res = sort_lines(sb.lines, sb.num_lines, &o);
+    if (res == 0)
+    {
+      res = write_lines(sb.lines, sb.num_lines, out_fd, 0);
+    }
+  }
+  else if (res == 0)
+  {
+    if (sb.num_lines > 0)
+    {
+      res = spill_run(&sb, &runs, &o);
+    }
+    if (res == 0)
+    {
+      res = merge_all_runs(&runs, out_fd, &o);
+    }
+  }
+  if (res != 0 && err == 0)
+  {
+    err = errno;
+  }
+
+  for (size_t i = 0; i < runs.size; i++)
+  {
+    close(runs.fds[i]);
+  }
+  free(runs.fds);
+  free(sb.arena);
+  free(sb.lines);
+  errno = err;
+  return res;
+}
@@ -0,0 +1,27 @@
+#ifndef LINE_SORT_H
+#define LINE_SORT_H
+
+#include <stddef.h>
+
+#define SORT_DEFAULT_MEM (64UL * 1024 * 1024) // bytes buffered before spilling a run
+#define SORT_MIN_MEM (64UL * 1024)            // smallest accepted memory budget
+#define SORT_MAX_THREADS 16
+#define SORT_MIN_PARALLEL 8192                // fewer lines than this sort on one thread
+#define SORT_MERGE_FANIN 64                   // most runs merged at once
+
+typedef struct {
+    int reverse;      // sort in descending order
+    int numeric;      // compare leading numbers, then whole lines
+    size_t mem_limit; // bytes of lines held in memory before spilling a sorted run
+    int threads;      // worker threads (0 = one per online CPU)
+} SortOptions;
+
+// Fill opts with the defaults (ascending byte order, SORT_DEFAULT_MEM, all CPUs)
+void sort_default_options(SortOptions *opts);
+
+// Sort the lines read from each of in_fds (in order) and write them to out_fd.
+// Lines are compared byte by byte, as in the C locale.
+// Returns 0 on success, -1 on error (errno is set)
+int sort_fds(const int *in_fds, size_t num_in, int out_fd, const SortOptions *opts);
+
+#endif // LINE_SORT_H
@@ -0,0 +1,222 @@
+#include "open_map.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Marks a deleted slot so that probe sequences running through it stay intact.
+static char om_tombstone_marker;
+#define OM_TOMBSTONE (&om_tombstone_marker)
+
+/**
+ * @Brief 64-bit FNV-1a hash. Spreads short keys well enough that the table
+ * can be indexed with a mask instead of a modulo.
+ *
+ * @param key The string to hash
+ * @return The hash value
+ */
+static uint64_t om_hash(const char *key)
+{
+  uint64_t h = 14695981039346656037ULL;
+  unsigned char c;
+  while ((c = (unsigned char)*key++))
+  {
+    h ^= c;
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+static OMSlot *om_alloc_slots(size_t capacity)
+{
+  OMSlot *slots = calloc(capacity, sizeof(OMSlot));
+  if (slots == NULL)
+  {
+    perror("calloc");
+    exit(-1);
+  }
+  return slots;
+}
+
+/**
+ * @Brief Find the slot holding key, or the slot where it should be inserted
+ * (the first tombstone seen on the way, else the empty slot ending the probe).
+ *
+ * @param om Pointer to the OpenMap
+ * @param key The key string
+ * @param found Set to 1 if the returned slot holds key, 0 otherwise
+ * @return Index of the slot
+ */
+static size_t om_probe(const OpenMap *om, const char *key, int *found)
+{
+  size_t mask = om->capacity - 1;
+  size_t i = om_hash(key) & mask;
+  size_t first_tombstone = om->capacity;
+
+  while (om->slots[i].key != NULL)
+  {
+    if (om->slots[i].key == OM_TOMBSTONE)
+    {
+      if (first_tombstone == om->capacity)
+      {
+        first_tombstone = i;
+      }
+    }
+    else if (strcmp(om->slots[i].key, key) == 0)
+    {
+      *found = 1;
+      return i;
+    }
+    i = (i + 1) & mask;
+  }
+
+  *found = 0;
+  return first_tombstone != om->capacity ? first_tombstone : i;
+}
+
+/**
+ * @Brief Rehash every live entry into a table of new_capacity slots.
+ * Drops tombstones as a side effect.
+ */
+static void om_resize(OpenMap *om, size_t new_capacity)
+{
+  OMSlot *old_slots = om->slots;
+  size_t old_capacity = om->capacity;
+
+  om->slots = om_alloc_slots(new_capacity);
+  om->capacity = new_capacity;
+  om->used = om->size;
+
+  size_t mask = new_capacity - 1;
+  for (size_t i = 0; i < old_capacity; i++)
+  {
+    char *key = old_slots[i].key;
+    if (key == NULL || key == OM_TOMBSTONE)
+    {
+      continue;
+    }
+    size_t j = om_hash(key) & mask;
+    while (om->slots[j].key != NULL)
+    {
+      j = (j + 1) & mask;
+    }
+    om->slots[j] = old_slots[i];
+  }
+  free(old_slots);
+}
+
+/**
+ * @Brief Create a new OpenMap
+ *
+ * @param init_capacity Number of entries the map should hold before growing
+ * @return Pointer to a newly created OpenMap
+ */
+OpenMap *om_create(size_t init_capacity)
+{
+  OpenMap *om = malloc(sizeof(OpenMap));
+  if (!om)
+  {
+    perror("malloc");
+    exit(-1);
+  }
+
+  // keep the load factor under 3/4 without an immediate resize.
+  size_t capacity = OM_MIN_CAPACITY;
+  while (capacity * 3 < init_capacity * 4)
+  {
+    capacity *= 2;
+  }
+
+  om->slots = om_alloc_slots(capacity);
+  om->capacity = capacity;
+  om->size = 0;
+  om->used = 0;
+  return om;
+}
+
+/**
+ * @Brief Insert or update key-value pair
+ *
+ * @param om Pointer to the OpenMap
+ * @param key The key string
+ * @param value The value string
+ */
+void om_put(OpenMap *om, const char *key, const char *value)
+{
+  int found;
+  size_t i = om_probe(om, key, &found);
+  if (found)
+  {
+    free(om->slots[i].value);
+    om->slots[i].value = strdup(value);
+    return;
+  }
+
+  // Grow (or just purge tombstones) before the load factor passes 3/4.
+  if ((om->used + 1) * 4 > om->capacity * 3)
+  {
+    om_resize(om, (om->size + 1) * 2 > om->capacity ? om->capacity * 2 : om->capacity);
+    i = om_probe(om, key, &found);
+  }
+
+  if (om->slots[i].key == NULL)
+  {
+    om->used++;
+  }
+  om->slots[i].key = strdup(key);
+  om->slots[i].value = strdup(value);
+  om->size++;
+}
+
+/**
+ * @Brief Get value by key (NULL if not found)
+ *
+ * @param om Pointer to the OpenMap
+ * @param key The key string
+ */
+char *om_get(const OpenMap *om, const char *key)
+{
+  int found;
+  size_t i = om_probe(om, key, &found);
+  return found ? om->slots[i].value : NULL;
+}
+
+/* Delete the entry with a given key from the map */
+void om_delete(OpenMap *om, const char *key)
+{
+  int found;
+  size_t i = om_probe(om, key, &found);
+  if (!found)
+  {
+    return;
+  }
+  free(om->slots[i].key);
+  free(om->slots[i].value);
+  om->slots[i].key = OM_TOMBSTONE;
+  om->slots[i].value = NULL;
+  om->size--;
+}
+
+/* Index of the next live slot at or after pos */
+size_t om_next(const OpenMap *om, size_t pos)
+{
+  while (pos < om->capacity &&
+         (om->slots[pos].key == NULL || om->slots[pos].key == OM_TOMBSTONE))
+  {
+    pos++;
+  }
+  return pos;
+}
+
+/* Free the memory used by the map */
+void om_free(OpenMap *om)
+{
+  for (size_t i = om_next(om, 0); i < om->capacity; i = om_next(om, i + 1))
+  {
+    free(om->slots[i].key);
+    free(om->slots[i].value);
+  }
+  free(om->slots);
+  free(om);
+}
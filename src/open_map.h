@@ -0,0 +1,41 @@
+#ifndef OPEN_MAP_H
+#define OPEN_MAP_H
+
+#include <stddef.h>
+
+#define OM_MIN_CAPACITY 8 // must be a power of two
+
+// Slot in the open-addressing table
+typedef struct {
+    char *key;   // NULL if empty, OM_TOMBSTONE if deleted
+    char *value;
+} OMSlot;
+
+// Open-addressing (linear probing) hash table that grows with its contents
+typedef struct {
+    OMSlot *slots;
+    size_t capacity; // Number of slots (always a power of two)
+    size_t size;     // Number of live entries
+    size_t used;     // Number of live entries + tombstones
+} OpenMap;
+
+// Create a new OpenMap with room for at least init_capacity entries
+OpenMap *om_create(size_t init_capacity);
+
+// Insert or update key-value pair. Handles resizing if necessary
+void om_put(OpenMap *om, const char *key, const char *value);
+
+// Get value by key (NULL if not found)
+char *om_get(const OpenMap *om, const char *key);
+
+// Delete Entry with given Key
+void om_delete(OpenMap *om, const char *key);
+
+// Index of the first live slot at or after pos (capacity when done).
+// Iterate with: for (i = om_next(om, 0); i < om->capacity; i = om_next(om, i + 1))
+size_t om_next(const OpenMap *om, size_t pos);
+
+// Free whole OpenMap
+void om_free(OpenMap *om);
+
+#endif // OPEN_MAP_H
@@ -0,0 +1,339 @@
+#define _GNU_SOURCE
+#include "prefetch.h"
+
+#include <elf.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Where the dynamic linker looks when LD_LIBRARY_PATH doesn't have a library
+static const char *default_lib_dirs[] = {
+    "/lib64", "/usr/lib64", "/lib/x86_64-linux-gnu", "/usr/lib/x86_64-linux-gnu",
+    "/lib/aarch64-linux-gnu", "/usr/lib/aarch64-linux-gnu", "/lib", "/usr/lib"};
+
+#define NUM_LIB_DIRS (sizeof(default_lib_dirs) / sizeof(default_lib_dirs[0]))
+#define PREFETCH_MAX_PHDRS 64
+#define PREFETCH_MAX_DYN 512
+#define PREFETCH_MAX_STRTAB (64 * 1024)
+
+/**
+ * @Brief Create a new Prefetcher
+ *
+ * @param script Path to the batch script
+ * @param lookahead Number of lines past the current one to scan
+ * @param follow_libs 1 to also prefetch DT_NEEDED libraries
+ * @return Pointer to a newly created Prefetcher, NULL if script can't be opened
+ */
+Prefetcher *pf_create(const char *script, int lookahead, int follow_libs)
+{
+  int fd = open(script, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+  {
+    return NULL;
+  }
+  Prefetcher *pf = malloc(sizeof(Prefetcher));
+  if (pf == NULL)
+  {
+    perror("malloc");
+    exit(-1);
+  }
+  pf->fd = fd;
+  pf->lookahead = lookahead;
+  pf->follow_libs = follow_libs;
+  pf->scan_line = 0;
+  pf->scan_pos = 0;
+  pf->done = hm_create();
+  pf->resolved = hm_create();
+  pf->libs = hm_create();
+  pf->path_env = NULL;
+  return pf;
+}
+
+/* Free the memory used by the Prefetcher */
+void pf_free(Prefetcher *pf)
+{
+  close(pf->fd);
+  hm_free(pf->done);
+  hm_free(pf->resolved);
+  hm_free(pf->libs);
+  free(pf->path_env);
+  free(pf);
+}
+
+/**
+ * @Brief Read the next unscanned line of the script. Lines are split exactly
+ * like fgets(3) with the same buffer size splits them, so line numbers agree
+ * with the shell's own reading loop. Uses pread(2): forked children share the
+ * script's file offset, so moving it here would race with them.
+ *
+ * @param pf Pointer to the Prefetcher
+ * @param buf Buffer receiving the NUL-terminated line
+ * @param size Size of buf
+ * @return Length of the line, 0 at EOF or on error
+ */
+ssize_t pf_read_line(Prefetcher *pf, char *buf, size_t size)
+{
+  ssize_t n = pread(pf->fd, buf, size - 1, pf->scan_pos);
+  if (n <= 0)
+  {
+    return 0;
+  }
+  char *newline = memchr(buf, '\n', n);
+  if (newline != NULL)
+  {
+    n = newline - buf + 1;
+  }
+  buf[n] = '\0';
+  pf->scan_pos += n;
+  pf->scan_line++;
+  return n;
+}
+
+/**
+ * @Brief Search a `:`-separated list of directories for name.
+ *
+ * @param dirs The directory list
+ * @param name File name to look for
+ * @param mode access(2) mode the file must satisfy
+ * @return Newly allocated full path, NULL if not found
+ */
+static char *pf_search(const char *dirs, const char *name, int mode)
+{
+  const char *dir = dirs;
+  while (dir != NULL && *dir != '\0')
+  {
+    const char *colon = strchr(dir, ':');
+    int len = colon ? (int)(colon - dir) : (int)strlen(dir);
+    char *candidate;
+    if (len > 0 && asprintf(&candidate, "%.*s/%s", len, dir, name) >= 0)
+    {
+      if (access(candidate, mode) == 0)
+      {
+        return candidate;
+      }
+      free(candidate);
+    }
+    dir = colon ? colon + 1 : NULL;
+  }
+  return NULL;
+}
+
+/* Resolve a command through PATH, caching the result */
+const char *pf_resolve(Prefetcher *pf, const char *command)
+{
+  if (strchr(command, '/') != NULL)
+  {
+    return access(command, X_OK) == 0 ? command : NULL;
+  }
+
+  // `path` may have changed PATH since the cache was built.
+  const char *path_env = getenv("PATH");
+  if (path_env == NULL)
+  {
+    return NULL;
+  }
+  if (pf->path_env == NULL || strcmp(pf->path_env, path_env) != 0)
+  {
+    hm_free(pf->resolved);
+    pf->resolved = hm_create();
+    free(pf->path_env);
+    pf->path_env = strdup(path_env);
+  }
+
+  char *cached = hm_get(pf->resolved, command);
+  if (cached == NULL)
+  {
+    char *found = pf_search(path_env, command, X_OK);
+    hm_put(pf->resolved, command, found ? found : "");
+    free(found);
+    cached = hm_get(pf->resolved, command);
+  }
+  return *cached == '\0' ? NULL : cached;
+}
+
+/* Find a shared library the way the dynamic linker would (minus ld.so.cache) */
+static const char *pf_find_lib(Prefetcher *pf, const char *name)
+{
+  char *cached = hm_get(pf->libs, name);
+  if (cached == NULL)
+  {
+    char *found = NULL;
+    const char *ld_path = getenv("LD_LIBRARY_PATH");
+    if (ld_path != NULL)
+    {
+      found = pf_search(ld_path, name, R_OK);
+    }
+    for (size_t i = 0; found == NULL && i < NUM_LIB_DIRS; i++)
+    {
+      found = pf_search(default_lib_dirs[i], name, R_OK);
+    }
+    hm_put(pf->libs, name, found ? found : "");
+    free(found);
+    cached = hm_get(pf->libs, name);
+  }
+  return *cached == '\0' ? NULL : cached;
+}
+
+/* Translate a virtual address to a file offset through the PT_LOAD segments */
+static long pf_vaddr_to_offset(const Elf64_Phdr *ph, int phnum, Elf64_Addr vaddr)
+{
+  for (int i = 0; i < phnum; i++)
+  {
+    if (ph[i].p_type == PT_LOAD && vaddr >= ph[i].p_vaddr &&
+        vaddr < ph[i].p_vaddr + ph[i].p_filesz)
+    {
+      return (long)(ph[i].p_offset + (vaddr - ph[i].p_vaddr));
+    }
+  }
+  return -1;
+}
+
+/**
+ * @Brief Read the DT_NEEDED entries of a 64-bit ELF file.
+ * Anything that isn't a well-formed dynamic ELF64 yields no entries.
+ *
+ * @param fd Open file descriptor of the binary
+ * @param names Receives up to PREFETCH_MAX_NEEDED library names
+ * @param strtab Receives the string table the names point into (caller frees)
+ * @return Number of names found
+ */
+static int pf_needed(int fd, const char **names, char **strtab)
+{
+  *strtab = NULL;
+  Elf64_Ehdr eh;
+  if (pread(fd, &eh, sizeof(eh), 0) != sizeof(eh) || memcmp(eh.e_ident, ELFMAG, SELFMAG) != 0 ||
+      eh.e_ident[EI_CLASS] != ELFCLASS64 || eh.e_phentsize != sizeof(Elf64_Phdr) ||
+      eh.e_phnum == 0 || eh.e_phnum > PREFETCH_MAX_PHDRS)
+  {
+    return 0;
+  }
+
+  Elf64_Phdr ph[PREFETCH_MAX_PHDRS];
+  ssize_t ph_size = eh.e_phnum * sizeof(Elf64_Phdr);
+  if (pread(fd, ph, ph_size, eh.e_phoff) != ph_size)
+  {
+    return 0;
+  }
+
+  const Elf64_Phdr *dynamic = NULL;
+  for (int i = 0; i < eh.e_phnum; i++)
+  {
+    if (ph[i].p_type == PT_DYNAMIC)
+    {
+      dynamic = &ph[i];
+    }
+  }
+  if (dynamic == NULL)
+  {
+    return 0; // statically linked.
+  }
+
+  Elf64_Dyn dyn[PREFETCH_MAX_DYN];
+  size_t dyn_count = dynamic->p_filesz / sizeof(Elf64_Dyn);
+  if (dyn_count > PREFETCH_MAX_DYN)
+  {
+    dyn_count = PREFETCH_MAX_DYN;
+  }
+  ssize_t dyn_size = dyn_count * sizeof(Elf64_Dyn);
+  if (pread(fd, dyn, dyn_size, dynamic->p_offset) != dyn_size)
+  {
+    return 0;
+  }
+
+  Elf64_Addr strtab_addr = 0;
+  size_t strtab_size = 0;
+  Elf64_Xword needed[PREFETCH_MAX_NEEDED];
+  int num_needed = 0;
+  for (size_t i = 0; i < dyn_count && dyn[i].d_tag != DT_NULL; i++)
+  {
+    if (dyn[i].d_tag == DT_STRTAB)
+    {
+      strtab_addr = dyn[i].d_un.d_ptr;
+    }
+    else if (dyn[i].d_tag == DT_STRSZ)
+    {
+      strtab_size = dyn[i].d_un.d_val;
+    }
+    else if (dyn[i].d_tag == DT_NEEDED && num_needed < PREFETCH_MAX_NEEDED)
+    {
+      needed[num_needed++] = dyn[i].d_un.d_val;
+    }
+  }
+
+  long strtab_offset = pf_vaddr_to_offset(ph, eh.e_phnum, strtab_addr);
+  if (num_needed == 0 || strtab_offset < 0 || strtab_size == 0 || strtab_size > PREFETCH_MAX_STRTAB)
+  {
+    return 0;
+  }
+  *strtab = malloc(strtab_size + 1);
+  if (*strtab == NULL ||
+      pread(fd, *strtab, strtab_size, strtab_offset) != (ssize_t)strtab_size)
+  {
+    return 0;
+  }
+  (*strtab)[strtab_size] = '\0';
+
+  int count = 0;
+  for (int i = 0; i < num_needed; i++)
+  {
+    if (needed[i] < strtab_size)
+    {
+      names[count++] = *strtab + needed[i];
+    }
+  }
+  return count;
+}
+
+/**
+ * @Brief Prefetch a file with posix_fadvise(WILLNEED), which only queues
+ * the reads, then do the same for its DT_NEEDED libraries.
+ *
+ * @param pf Pointer to the Prefetcher
+ * @param path File to prefetch
+ * @param budget Most bytes to issue readahead for
+ * @return Bytes of readahead issued
+ */
+size_t pf_file(Prefetcher *pf, const char *path, size_t budget)
+{
+  if (budget == 0 || hm_get(pf->done, path) != NULL)
+  {
+    return 0;
+  }
+  hm_put(pf->done, path, "");
+
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+  {
+    return 0;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+  {
+    close(fd);
+    return 0;
+  }
+
+  size_t used = (size_t)st.st_size < budget ? (size_t)st.st_size : budget;
+  posix_fadvise(fd, 0, used, POSIX_FADV_WILLNEED);
+
+  if (pf->follow_libs)
+  {
+    const char *names[PREFETCH_MAX_NEEDED];
+    char *strtab;
+    int num_names = pf_needed(fd, names, &strtab);
+    for (int i = 0; i < num_names && used < budget; i++)
+    {
+      const char *lib = pf_find_lib(pf, names[i]);
+      if (lib != NULL)
+      {
+        used += pf_file(pf, lib, budget - used);
+      }
+    }
+    free(strtab);
+  }
+  close(fd);
+  return used;
+}
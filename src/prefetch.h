@@ -0,0 +1,45 @@
+#ifndef PREFETCH_H
+#define PREFETCH_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "hash_map.h"
+
+#define PREFETCH_DEFAULT_LOOKAHEAD 8         // batch lines scanned ahead
+#define PREFETCH_BUDGET (32UL * 1024 * 1024) // bytes of readahead issued per scan
+#define PREFETCH_MAX_NEEDED 64               // DT_NEEDED entries followed per binary
+
+// Warms the page cache for binaries that a batch script is about to run
+typedef struct {
+    int fd;             // script, read with pread(2) so the shell's FILE is untouched
+    int lookahead;      // how many lines past the current one to scan
+    int follow_libs;    // also prefetch DT_NEEDED shared libraries
+    long scan_line;     // number of script lines scanned so far
+    long scan_pos;      // file offset of the first line not yet scanned
+    HashMap *done;      // files already prefetched
+    HashMap *resolved;  // command name -> path ("" if not found)
+    HashMap *libs;      // library name -> path ("" if not found)
+    char *path_env;     // PATH that `resolved` was built for
+} Prefetcher;
+
+// Create a Prefetcher that scans script lookahead lines ahead.
+// Returns NULL if script can't be opened
+Prefetcher *pf_create(const char *script, int lookahead, int follow_libs);
+
+// Read the next unscanned script line into buf, split like fgets(3).
+// Returns its length, 0 at EOF or on error
+ssize_t pf_read_line(Prefetcher *pf, char *buf, size_t size);
+
+// Resolve a command through PATH, caching the result.
+// Returns the full path, NULL if not found. Never prints anything
+const char *pf_resolve(Prefetcher *pf, const char *command);
+
+// Ask the kernel to read path (and its libraries) ahead, using at most
+// budget bytes. Files are only prefetched once. Returns the bytes issued
+size_t pf_file(Prefetcher *pf, const char *path, size_t budget);
+
+// Free whole Prefetcher
+void pf_free(Prefetcher *pf);
+
+#endif // PREFETCH_H
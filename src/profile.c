@@ -0,0 +1,376 @@
+#define _GNU_SOURCE
+#include "profile.h"
+
+#include <dlfcn.h>
+#include <elf.h>
+#include <errno.h>
+#include <execinfo.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "open_map.h"
+
+#define PROF_NAME_SIZE 256
+#define PROF_STACK_SIZE (PROF_MAX_DEPTH * PROF_NAME_SIZE)
+
+// A function of wsh itself, from its .symtab (which has the static ones too)
+typedef struct {
+    uintptr_t start;
+    uintptr_t size;
+    const char *name;
+} ProfFunction;
+
+// Written by the SIGPROF handler, so nothing here is allocated after prof_start().
+static ProfSample *prof_samples; // PROF_MAX_SAMPLES of them, NULL when not sampling
+static size_t prof_taken;        // samples taken, including those that didn't fit
+static pid_t prof_owner;         // the process that started sampling
+static char *prof_out;           // where the folded stacks go
+
+/**
+ * @Brief SIGPROF handler: capture the interrupted stack into the next
+ * preallocated sample. backtrace() is only async-signal-safe once libgcc's
+ * unwinder is loaded, which prof_start() makes sure of. Samples may come
+ * in on any thread (sort workers included), hence the atomic slot claim.
+ */
+static void prof_handler(int sig)
+{
+  (void)sig;
+  int saved_errno = errno;
+  size_t i = __atomic_fetch_add(&prof_taken, 1, __ATOMIC_RELAXED);
+  if (i < PROF_MAX_SAMPLES)
+  {
+    prof_samples[i].depth = backtrace(prof_samples[i].frames, PROF_MAX_DEPTH);
+  }
+  errno = saved_errno;
+}
+
+/**
+ * @Brief Start sampling with ITIMER_PROF, which counts the CPU time of
+ * every thread of the process. Forked children don't inherit the timer.
+ *
+ * @param hz Samples per second of CPU time
+ * @param out_path File for the folded stacks, NULL for wsh.<pid>.folded
+ * in the current directory
+ * @return 0 on success, -1 on error
+ */
+int prof_start(int hz, const char *out_path)
+{
+  if (hz < 1 || hz > PROF_MAX_HZ || prof_samples != NULL)
+  {
+    return -1;
+  }
+
+  // untouched pages cost nothing, so reserve room for every sample up front.
+  void *samples = mmap(NULL, PROF_MAX_SAMPLES * sizeof(ProfSample), PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (samples == MAP_FAILED)
+  {
+    return -1;
+  }
+
+  // the path is made absolute now, since `cd` may change directory later.
+  if (out_path != NULL)
+  {
+    prof_out = strdup(out_path);
+  }
+  else
+  {
+    char *cwd = getcwd(NULL, 0);
+    if (cwd == NULL || asprintf(&prof_out, "%s/wsh.%d.folded", cwd, getpid()) < 0)
+    {
+      prof_out = NULL;
+    }
+    free(cwd);
+  }
+  if (prof_out == NULL)
+  {
+    munmap(samples, PROF_MAX_SAMPLES * sizeof(ProfSample));
+    return -1;
+  }
+
+  // the first backtrace() loads the unwinder (malloc, dlopen): do it here.
+  void *warm_up[PROF_MAX_DEPTH];
+  backtrace(warm_up, PROF_MAX_DEPTH);
+
+  prof_samples = samples;
+  prof_taken = 0;
+  prof_owner = getpid();
+
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = prof_handler;
+  sa.sa_flags = SA_RESTART;
+  sigemptyset(&sa.sa_mask);
+
+  long usec = 1000000L / hz;
+  struct itimerval timer;
+  timer.it_interval.tv_sec = usec / 1000000;
+  timer.it_interval.tv_usec = usec % 1000000;
+  timer.it_value = timer.it_interval;
+  if (sigaction(SIGPROF, &sa, NULL) != 0 || setitimer(ITIMER_PROF, &timer, NULL) != 0)
+  {
+    signal(SIGPROF, SIG_DFL);
+    munmap(prof_samples, PROF_MAX_SAMPLES * sizeof(ProfSample));
+    prof_samples = NULL;
+    free(prof_out);
+    prof_out = NULL;
+    return -1;
+  }
+  return 0;
+}
+
+static int prof_function_cmp(const void *a, const void *b)
+{
+  const ProfFunction *fa = a;
+  const ProfFunction *fb = b;
+  return fa->start < fb->start ? -1 : (fa->start > fb->start);
+}
+
+/**
+ * @Brief Read the function symbols of the running executable, so static
+ * functions get names too. Only done at exit, never in the signal handler.
+ *
+ * @param image Receives the file contents the names point into (caller frees)
+ * @param count Receives the number of functions
+ * @return The functions sorted by address, NULL if there are none
+ */
+static ProfFunction *prof_load_functions(char **image, size_t *count)
+{
+  *image = NULL;
+  *count = 0;
+  FILE *fp = fopen("/proc/self/exe", "r");
+  if (fp == NULL)
+  {
+    return NULL;
+  }
+  long size = -1;
+  if (fseek(fp, 0, SEEK_END) == 0)
+  {
+    size = ftell(fp);
+    rewind(fp);
+  }
+  if (size < (long)sizeof(Elf64_Ehdr) || (*image = malloc(size)) == NULL ||
+      fread(*image, 1, size, fp) != (size_t)size)
+  {
+    fclose(fp);
+    free(*image);
+    *image = NULL;
+    return NULL;
+  }
+  fclose(fp);
+
+  const Elf64_Ehdr *eh = (const Elf64_Ehdr *)*image;
+  if (memcmp(eh->e_ident, ELFMAG, SELFMAG) != 0 || eh->e_ident[EI_CLASS] != ELFCLASS64 ||
+      eh->e_shentsize != sizeof(Elf64_Shdr) ||
+      eh->e_shoff + (unsigned long)eh->e_shnum * sizeof(Elf64_Shdr) > (unsigned long)size)
+  {
+    return NULL;
+  }
+  const Elf64_Shdr *sh = (const Elf64_Shdr *)(*image + eh->e_shoff);
+  for (int i = 0; i < eh->e_shnum; i++)
+  {
+    if (sh[i].sh_type != SHT_SYMTAB || sh[i].sh_link >= eh->e_shnum ||
+        sh[i].sh_offset + sh[i].sh_size > (unsigned long)size ||
+        sh[sh[i].sh_link].sh_offset + sh[sh[i].sh_link].sh_size > (unsigned long)size)
+    {
+      continue;
+    }
+    const Elf64_Sym *syms = (const Elf64_Sym *)(*image + sh[i].sh_offset);
+    size_t num_syms = sh[i].sh_size / sizeof(Elf64_Sym);
+    const char *strtab = *image + sh[sh[i].sh_link].sh_offset;
+    size_t strtab_size = sh[sh[i].sh_link].sh_size;
+
+    ProfFunction *functions = malloc(num_syms * sizeof(ProfFunction));
+    if (functions == NULL)
+    {
+      perror("malloc");
+      exit(-1);
+    }
+    for (size_t j = 0; j < num_syms; j++)
+    {
+      if (ELF64_ST_TYPE(syms[j].st_info) == STT_FUNC && syms[j].st_value != 0 &&
+          syms[j].st_name < strtab_size)
+      {
+        functions[*count].start = syms[j].st_value;
+        functions[*count].size = syms[j].st_size;
+        functions[*count].name = strtab + syms[j].st_name;
+        (*count)++;
+      }
+    }
+    qsort(functions, *count, sizeof(ProfFunction), prof_function_cmp);
+    return functions;
+  }
+  return NULL;
+}
+
+/* Function of wsh containing addr (relative to where wsh is loaded), NULL if none */
+static const char *prof_find_function(const ProfFunction *functions, size_t count, uintptr_t addr)
+{
+  size_t lo = 0, hi = count;
+  while (lo < hi)
+  {
+    size_t mid = lo + (hi - lo) / 2;
+    if (functions[mid].start <= addr)
+    {
+      lo = mid + 1;
+    }
+    else
+    {
+      hi = mid;
+    }
+  }
+  if (lo == 0 || addr >= functions[lo - 1].start + functions[lo - 1].size)
+  {
+    return NULL;
+  }
+  return functions[lo - 1].name;
+}
+
+/* Difference between wsh's run-time and link-time addresses (0 unless PIE) */
+static uintptr_t prof_load_bias(const Dl_info *self)
+{
+  const Elf64_Ehdr *eh = self->dli_fbase;
+  return eh->e_type == ET_DYN ? (uintptr_t)self->dli_fbase : 0;
+}
+
+/**
+ * @Brief Name a return address: its function if it is in wsh's symbol
+ * table or exported by a library, otherwise just the object file, so
+ * that anonymous frames of one library fold together.
+ *
+ * @param names Cache of names already looked up, by address
+ * @param functions wsh's own functions, sorted by address
+ * @param count Number of functions
+ * @param addr Address inside the function
+ * @return The name, owned by names
+ */
+static const char *prof_symbol(OpenMap *names, const ProfFunction *functions, size_t count,
+                               void *addr)
+{
+  char key[2 + sizeof(void *) * 2 + 1];
+  snprintf(key, sizeof(key), "%p", addr);
+  char *name = om_get(names, key);
+  if (name != NULL)
+  {
+    return name;
+  }
+
+  char text[PROF_NAME_SIZE];
+  Dl_info info, self;
+  const char *function = NULL;
+  if (dladdr(addr, &info) == 0 || info.dli_fname == NULL)
+  {
+    snprintf(text, sizeof(text), "[unknown]");
+  }
+  else if (dladdr(&prof_taken, &self) != 0 && info.dli_fbase == self.dli_fbase &&
+           (function = prof_find_function(functions, count, (uintptr_t)addr - prof_load_bias(&self))) != NULL)
+  {
+    snprintf(text, sizeof(text), "%s", function);
+  }
+  else if (info.dli_sname != NULL)
+  {
+    snprintf(text, sizeof(text), "%s", info.dli_sname);
+  }
+  else
+  {
+    const char *file = strrchr(info.dli_fname, '/');
+    snprintf(text, sizeof(text), "[%s]", file ? file + 1 : info.dli_fname);
+  }
+  om_put(names, key, text);
+  return om_get(names, key);
+}
+
+/**
+ * @Brief Stop sampling and write one `outermost;...;innermost count` line
+ * per distinct stack, the folded format flamegraph.pl and most flame graph
+ * viewers read. Samples that didn't fit in the buffer are counted under
+ * a `[dropped]` frame.
+ *
+ * @return 0 on success (or not sampling here), -1 on error
+ */
+int prof_finish(void)
+{
+  if (prof_samples == NULL || getpid() != prof_owner)
+  {
+    return 0;
+  }
+  struct itimerval off;
+  memset(&off, 0, sizeof(off));
+  setitimer(ITIMER_PROF, &off, NULL);
+  signal(SIGPROF, SIG_IGN);
+
+  size_t taken = prof_taken < PROF_MAX_SAMPLES ? prof_taken : PROF_MAX_SAMPLES;
+  char *image;
+  size_t num_functions;
+  ProfFunction *functions = prof_load_functions(&image, &num_functions);
+  OpenMap *names = om_create(OM_MIN_CAPACITY);
+  OpenMap *stacks = om_create(OM_MIN_CAPACITY);
+  char *stack = malloc(PROF_STACK_SIZE);
+  if (stack == NULL)
+  {
+    perror("malloc");
+    exit(-1);
+  }
+  for (size_t i = 0; i < taken; i++)
+  {
+    ProfSample *sample = &prof_samples[i];
+    size_t len = 0;
+    stack[0] = '\0';
+    for (int f = sample->depth - 1; f >= PROF_SKIP_FRAMES && len < PROF_STACK_SIZE; f--)
+    {
+      // return addresses point after the call; look up the call itself.
+      char *addr = sample->frames[f];
+      const char *name = prof_symbol(names, functions, num_functions, f == PROF_SKIP_FRAMES ? addr : addr - 1);
+      len += snprintf(stack + len, PROF_STACK_SIZE - len, "%s%s", len ? ";" : "", name);
+    }
+    if (stack[0] == '\0')
+    {
+      continue;
+    }
+    char *count = om_get(stacks, stack);
+    char text[32];
+    snprintf(text, sizeof(text), "%ld", (count ? strtol(count, NULL, 10) : 0) + 1);
+    om_put(stacks, stack, text);
+  }
+
+  int res = 0;
+  FILE *fp = fopen(prof_out, "w");
+  if (fp == NULL)
+  {
+    perror(prof_out);
+    res = -1;
+  }
+  else
+  {
+    for (size_t i = om_next(stacks, 0); i < stacks->capacity; i = om_next(stacks, i + 1))
+    {
+      fprintf(fp, "%s %s\n", stacks->slots[i].key, stacks->slots[i].value);
+    }
+    if (prof_taken > PROF_MAX_SAMPLES)
+    {
+      fprintf(fp, "[dropped] %zu\n", prof_taken - PROF_MAX_SAMPLES);
+    }
+    if (fclose(fp) != 0)
+    {
+      perror(prof_out);
+      res = -1;
+    }
+  }
+
+  free(stack);
+  free(functions);
+  free(image);
+  om_free(names);
+  om_free(stacks);
+  munmap(prof_samples, PROF_MAX_SAMPLES * sizeof(ProfSample));
+  prof_samples = NULL;
+  free(prof_out);
+  prof_out = NULL;
+  return res;
+}
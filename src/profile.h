@@ -0,0 +1,25 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stddef.h>
+
+#define PROF_MAX_HZ 10000        // highest sampling rate accepted
+#define PROF_MAX_SAMPLES 65536   // samples kept; later ones are only counted
+#define PROF_MAX_DEPTH 64        // frames kept per sample
+#define PROF_SKIP_FRAMES 2       // the signal handler and the signal trampoline
+
+// One stack captured by the SIGPROF handler
+typedef struct {
+    int depth;
+    void *frames[PROF_MAX_DEPTH]; // innermost first
+} ProfSample;
+
+// Start sampling this process's CPU time at hz samples per second.
+// Returns 0 on success, -1 if hz is out of range or the timer can't be set
+int prof_start(int hz, const char *out_path);
+
+// Stop sampling and write the folded stacks. Does nothing in forked
+// children or when not sampling. Returns 0 on success, -1 on error
+int prof_finish(void);
+
+#endif // PROFILE_H
@@ -0,0 +1,221 @@
+#define _GNU_SOURCE
+#include "sched.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DDB_KEY_SIZE 17 // 16 hex digits and '\0'
+
+/**
+ * @Brief Key a line by the 64-bit FNV-1a hash of its text, without the
+ * trailing newline, so the database never stores script contents.
+ *
+ * @param line The script line
+ * @param key Receives the hash as 16 hex digits
+ */
+static void ddb_key(const char *line, char key[DDB_KEY_SIZE])
+{
+  uint64_t h = 14695981039346656037ULL;
+  size_t len = strcspn(line, "\n");
+  for (size_t i = 0; i < len; i++)
+  {
+    h ^= (unsigned char)line[i];
+    h *= 1099511628211ULL;
+  }
+  snprintf(key, DDB_KEY_SIZE, "%016llx", (unsigned long long)h);
+}
+
+/**
+ * @Brief Load a duration database. Each line of the file is
+ * `<hash> <seconds>`; malformed lines are skipped.
+ *
+ * @param path The database file, NULL to keep the database in memory
+ * @return Pointer to a newly created DurationDb
+ */
+DurationDb *ddb_open(const char *path)
+{
+  DurationDb *db = malloc(sizeof(DurationDb));
+  if (db == NULL)
+  {
+    perror("malloc");
+    exit(-1);
+  }
+  db->times = om_create(OM_MIN_CAPACITY);
+  db->path = path ? strdup(path) : NULL;
+  db->dirty = 0;
+
+  FILE *fp = path ? fopen(path, "r") : NULL;
+  if (fp == NULL)
+  {
+    return db;
+  }
+  char key[DDB_KEY_SIZE];
+  char value[32];
+  double seconds;
+  while (fscanf(fp, "%16s %lf%*[^\n]", key, &seconds) == 2)
+  {
+    if (strlen(key) == DDB_KEY_SIZE - 1 && seconds >= 0)
+    {
+      snprintf(value, sizeof(value), "%.6f", seconds);
+      om_put(db->times, key, value);
+    }
+  }
+  fclose(fp);
+  return db;
+}
+
+/* Look up a line's expected duration */
+int ddb_lookup(const DurationDb *db, const char *line, double *seconds)
+{
+  char key[DDB_KEY_SIZE];
+  ddb_key(line, key);
+  char *value = om_get(db->times, key);
+  if (value == NULL)
+  {
+    return 0;
+  }
+  *seconds = strtod(value, NULL);
+  return 1;
+}
+
+/**
+ * @Brief Fold a measured duration into a line's estimate with an
+ * exponentially weighted moving average, so estimates follow lines
+ * that get slower or faster without being thrown by one odd run.
+ *
+ * @param db Pointer to the DurationDb
+ * @param line The script line
+ * @param seconds How long it took this time
+ */
+void ddb_record(DurationDb *db, const char *line, double seconds)
+{
+  double estimate;
+  if (ddb_lookup(db, line, &estimate))
+  {
+    seconds = estimate + SCHED_EWMA_WEIGHT * (seconds - estimate);
+  }
+  char key[DDB_KEY_SIZE];
+  char value[32];
+  ddb_key(line, key);
+  snprintf(value, sizeof(value), "%.6f", seconds);
+  om_put(db->times, key, value);
+  db->dirty = 1;
+}
+
+/**
+ * @Brief Write the database back through a temporary file and rename(2),
+ * so a concurrent run reads either the old or the new contents.
+ *
+ * @param db Pointer to the DurationDb
+ * @return 0 on success (or nothing to do), -1 on error
+ */
+int ddb_save(DurationDb *db)
+{
+  if (db->path == NULL || !db->dirty)
+  {
+    return 0;
+  }
+  char *tmp_path;
+  if (asprintf(&tmp_path, "%s.%d", db->path, getpid()) < 0)
+  {
+    return -1;
+  }
+  FILE *fp = fopen(tmp_path, "w");
+  if (fp == NULL)
+  {
+    free(tmp_path);
+    return -1;
+  }
+  for (size_t i = om_next(db->times, 0); i < db->times->capacity; i = om_next(db->times, i + 1))
+  {
+    fprintf(fp, "%s %s\n", db->times->slots[i].key, db->times->slots[i].value);
+  }
+  int res = 0;
+  if (fclose(fp) != 0 || rename(tmp_path, db->path) != 0)
+  {
+    unlink(tmp_path);
+    res = -1;
+  }
+  free(tmp_path);
+  db->dirty = 0;
+  return res;
+}
+
+/* Free the memory used by the DurationDb */
+void ddb_free(DurationDb *db)
+{
+  om_free(db->times);
+  free(db->path);
+  free(db);
+}
+
+/* Longest predicted duration first; script order among equals */
+static int sched_longer(const void *a, const void *b, void *arg)
+{
+  const SchedJob *jobs = arg;
+  size_t i = *(const size_t *)a;
+  size_t j = *(const size_t *)b;
+  if (jobs[i].predicted != jobs[j].predicted)
+  {
+    return jobs[i].predicted > jobs[j].predicted ? -1 : 1;
+  }
+  return i < j ? -1 : (i > j);
+}
+
+/**
+ * @Brief Order jobs longest-first (LPT) and simulate handing them to slots
+ * workers, each job going to whichever worker frees up first. Starting the
+ * long jobs early keeps one of them from running alone at the end.
+ *
+ * @param jobs The jobs, with predicted durations filled in
+ * @param n Number of jobs
+ * @param slots Number of jobs run at once
+ * @param order Receives the job indices in the order to start them
+ * @return Predicted makespan in seconds
+ */
+double sched_order(const SchedJob *jobs, size_t n, int slots, size_t *order)
+{
+  for (size_t i = 0; i < n; i++)
+  {
+    order[i] = i;
+  }
+  qsort_r(order, n, sizeof(size_t), sched_longer, (void *)jobs);
+
+  double *finish = calloc(slots, sizeof(double));
+  if (finish == NULL)
+  {
+    perror("calloc");
+    exit(-1);
+  }
+  double makespan = 0;
+  for (size_t i = 0; i < n; i++)
+  {
+    int first_free = 0;
+    for (int s = 1; s < slots; s++)
+    {
+      if (finish[s] < finish[first_free])
+      {
+        first_free = s;
+      }
+    }
+    finish[first_free] += jobs[order[i]].predicted;
+    if (finish[first_free] > makespan)
+    {
+      makespan = finish[first_free];
+    }
+  }
+  free(finish);
+  return makespan;
+}
+
+/* Seconds on the monotonic clock */
+double sched_now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
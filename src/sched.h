@@ -0,0 +1,51 @@
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "open_map.h"
+
+#define SCHED_MAX_JOBS 256           // upper bound for WSH_JOBS
+#define SCHED_DEFAULT_DB ".wsh_times" // duration database, relative to $HOME
+#define SCHED_EWMA_WEIGHT 0.5        // weight of the newest run in a line's estimate
+
+// Per-line durations remembered across runs
+typedef struct {
+    OpenMap *times; // line hash (hex) -> seconds
+    char *path;     // file loaded from and saved to, NULL to keep it in memory
+    int dirty;      // 1 if times changed since loading
+} DurationDb;
+
+// One script line in a group of lines that can run in any order
+typedef struct {
+    char *line;
+    double predicted; // expected seconds
+    int known;        // 1 if predicted came from the database
+    pid_t pid;        // 0 until started
+    double start;     // sched_now() when started
+} SchedJob;
+
+// Load the database at path. A missing or unreadable file gives an empty one
+DurationDb *ddb_open(const char *path);
+
+// Look up a line's expected duration. Returns 1 if found, 0 if not
+int ddb_lookup(const DurationDb *db, const char *line, double *seconds);
+
+// Fold a measured duration into a line's estimate
+void ddb_record(DurationDb *db, const char *line, double seconds);
+
+// Write the database back if it changed. Returns 0 on success, -1 on error
+int ddb_save(DurationDb *db);
+
+// Free whole DurationDb
+void ddb_free(DurationDb *db);
+
+// Fill order with the jobs longest-first and return the makespan that list
+// scheduling them onto slots workers is predicted to take
+double sched_order(const SchedJob *jobs, size_t n, int slots, size_t *order);
+
+// Seconds on the monotonic clock
+double sched_now(void);
+
+#endif // SCHED_H
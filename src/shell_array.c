@@ -0,0 +1,406 @@
+#include "shell_array.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// characters an associative key can be listed with unquoted
+#define SA_PLAIN_KEY_CHARS "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789_.-"
+
+/**
+ * @Brief Parse an indexed-array subscript
+ *
+ * @param key The subscript string
+ * @param ind Where to store the parsed index
+ * @return 0 if key is a non-negative decimal number, 1 otherwise
+ */
+static int sa_parse_index(const char *key, size_t *ind)
+{
+  if (!isdigit((unsigned char)key[0]))
+  {
+    return 1;
+  }
+  char *endptr;
+  unsigned long long n = strtoull(key, &endptr, 10);
+  if (*endptr != '\0')
+  {
+    return 1;
+  }
+  *ind = (size_t)n;
+  return 0;
+}
+
+static ShellArray *sa_create(const char *name, ArrayKind kind)
+{
+  ShellArray *sa = malloc(sizeof(ShellArray));
+  if (sa == NULL)
+  {
+    perror("malloc");
+    exit(-1);
+  }
+  sa->name = strdup(name);
+  sa->kind = kind;
+  sa->indexed = kind == ARRAY_INDEXED ? da_create(8) : NULL;
+  sa->assoc = kind == ARRAY_ASSOC ? om_create(8) : NULL;
+  return sa;
+}
+
+static void sa_destroy(ShellArray *sa)
+{
+  if (sa->indexed != NULL)
+  {
+    da_free(sa->indexed);
+  }
+  if (sa->assoc != NULL)
+  {
+    om_free(sa->assoc);
+  }
+  free(sa->name);
+  free(sa);
+}
+
+/**
+ * @Brief Create a new ArrayTable
+ *
+ * @return Pointer to a newly created ArrayTable
+ */
+ArrayTable *at_create(void)
+{
+  ArrayTable *at = malloc(sizeof(ArrayTable));
+  if (at == NULL)
+  {
+    perror("malloc");
+    exit(-1);
+  }
+  at->arrays = NULL;
+  at->size = 0;
+  at->capacity = 0;
+  return at;
+}
+
+/**
+ * @Brief Get array by name (NULL if not found)
+ *
+ * @param at Pointer to the ArrayTable
+ * @param name Name of the array
+ */
+ShellArray *at_get(const ArrayTable *at, const char *name)
+{
+  for (size_t i = 0; i < at->size; i++)
+  {
+    if (strcmp(at->arrays[i]->name, name) == 0)
+    {
+      return at->arrays[i];
+    }
+  }
+  return NULL;
+}
+
+/**
+ * @Brief Get array by name, creating it if it doesn't exist
+ * (or exists with a different kind).
+ *
+ * @param at Pointer to the ArrayTable
+ * @param name Name of the array
+ * @param kind Kind the array must have
+ * @return The array
+ */
+ShellArray *at_declare(ArrayTable *at, const char *name, ArrayKind kind)
+{
+  for (size_t i = 0; i < at->size; i++)
+  {
+    if (strcmp(at->arrays[i]->name, name) == 0)
+    {
+      if (at->arrays[i]->kind != kind)
+      {
+        sa_destroy(at->arrays[i]);
+        at->arrays[i] = sa_create(name, kind);
+      }
+      return at->arrays[i];
+    }
+  }
+
+  if (at->size == at->capacity)
+  {
+    at->capacity = (at->capacity == 0) ? 4 : at->capacity * 2;
+    at->arrays = realloc(at->arrays, at->capacity * sizeof(ShellArray *));
+    if (at->arrays == NULL)
+    {
+      perror("realloc");
+      exit(-1);
+    }
+  }
+  at->arrays[at->size] = sa_create(name, kind);
+  return at->arrays[at->size++];
+}
+
+/* Delete the array with a given name from the table */
+void at_delete(ArrayTable *at, const char *name)
+{
+  for (size_t i = 0; i < at->size; i++)
+  {
+    if (strcmp(at->arrays[i]->name, name) == 0)
+    {
+      sa_destroy(at->arrays[i]);
+      memmove(&at->arrays[i], &at->arrays[i + 1],
+              (at->size - i - 1) * sizeof(ShellArray *));
+      at->size--;
+      return;
+    }
+  }
+}
+
+/* Free the memory used by the table and every array in it */
+void at_free(ArrayTable *at)
+{
+  for (size_t i = 0; i < at->size; i++)
+  {
+    sa_destroy(at->arrays[i]);
+  }
+  free(at->arrays);
+  free(at);
+}
+
+/* 1 if the first len characters of name form a valid array name */
+int sa_valid_name(const char *name, size_t len)
+{
+  if (len == 0 || !(isalpha((unsigned char)name[0]) || name[0] == '_'))
+  {
+    return 0;
+  }
+  for (size_t i = 1; i < len; i++)
+  {
+    if (!(isalnum((unsigned char)name[i]) || name[i] == '_'))
+    {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/**
+ * @Brief Check a subscript without setting anything. Indexed arrays are
+ * stored densely, so an index far past the end (which would pad the gap
+ * with millions of empty elements) is a bad subscript.
+ *
+ * @param kind Kind of the array
+ * @param key Subscript (a non-negative number for indexed arrays)
+ * @param size Number of elements of an indexed array; updated to the
+ * size it would have once key is set
+ * @return 0 if sa_set() would accept key, 1 on a bad subscript
+ */
+int sa_check_key(ArrayKind kind, const char *key, size_t *size)
+{
+  if (kind == ARRAY_ASSOC)
+  {
+    return 0;
+  }
+
+  size_t ind;
+  if (sa_parse_index(key, &ind) != 0 || ind > *size + SA_MAX_GAP)
+  {
+    return 1;
+  }
+  if (ind >= *size)
+  {
+    *size = ind + 1;
+  }
+  return 0;
+}
+
+/**
+ * @Brief Set element at key
+ *
+ * @param sa Pointer to the array
+ * @param key Subscript (a non-negative number for indexed arrays)
+ * @param value The value string
+ * @return 0 on success, 1 on a bad subscript (see sa_check_key)
+ */
+int sa_set(ShellArray *sa, const char *key, const char *value)
+{
+  if (sa->kind == ARRAY_ASSOC)
+  {
+    om_put(sa->assoc, key, value);
+    return 0;
+  }
+
+  size_t size = sa->indexed->size;
+  size_t ind;
+  if (sa_check_key(sa->kind, key, &size) != 0 || sa_parse_index(key, &ind) != 0)
+  {
+    return 1;
+  }
+  da_set(sa->indexed, ind, value);
+  return 0;
+}
+
+/**
+ * @Brief Get element at key (NULL if not set or subscript is invalid)
+ *
+ * @param sa Pointer to the array
+ * @param key Subscript
+ */
+char *sa_get(const ShellArray *sa, const char *key)
+{
+  if (sa->kind == ARRAY_ASSOC)
+  {
+    return om_get(sa->assoc, key);
+  }
+
+  size_t ind;
+  if (sa_parse_index(key, &ind) != 0)
+  {
+    return NULL;
+  }
+  return da_get(sa->indexed, ind);
+}
+
+/**
+ * @Brief Delete element at key. In an indexed array, later elements keep
+ * their indices: the slot is emptied, like the padding of a gap, and only
+ * deleting the last element shortens the array.
+ *
+ * @param sa Pointer to the array
+ * @param key Subscript
+ * @return 0 on success, 1 on a bad subscript
+ */
+int sa_delete(ShellArray *sa, const char *key)
+{
+  if (sa->kind == ARRAY_ASSOC)
+  {
+    om_delete(sa->assoc, key);
+    return 0;
+  }
+
+  size_t ind;
+  if (sa_parse_index(key, &ind) != 0)
+  {
+    return 1;
+  }
+  DynamicArray *da = sa->indexed;
+  if (ind + 1 == da->size)
+  {
+    free(da->data[ind]);
+    da->size--;
+  }
+  else if (ind < da->size)
+  {
+    da_set(da, ind, "");
+  }
+  return 0;
+}
+
+/* Number of elements in the array */
+size_t sa_length(const ShellArray *sa)
+{
+  return sa->kind == ARRAY_ASSOC ? sa->assoc->size : sa->indexed->size;
+}
+
+/* Append all keys or all values of the array to out */
+void sa_collect(const ShellArray *sa, int keys, DynamicArray *out)
+{
+  if (sa->kind == ARRAY_ASSOC)
+  {
+    const OpenMap *om = sa->assoc;
+    for (size_t i = om_next(om, 0); i < om->capacity; i = om_next(om, i + 1))
+    {
+      da_put(out, keys ? om->slots[i].key : om->slots[i].value);
+    }
+    return;
+  }
+
+  for (size_t i = 0; i < sa->indexed->size; i++)
+  {
+    if (keys)
+    {
+      char buf[32];
+      snprintf(buf, sizeof(buf), "%zu", i);
+      da_put(out, buf);
+    }
+    else
+    {
+      da_put(out, sa->indexed->data[i]);
+    }
+  }
+}
+
+/**
+ * @Brief Create a detached, empty array to build a new value in
+ * before it replaces a real array's elements with sa_commit().
+ *
+ * @param name Name of the array
+ * @param kind Kind of the array
+ * @return The staged array
+ */
+ShellArray *sa_stage(const char *name, ArrayKind kind)
+{
+  return sa_create(name, kind);
+}
+
+/* Move the staged elements into sa and free the staged array */
+void sa_commit(ShellArray *sa, ShellArray *staged)
+{
+  ShellArray old = *sa;
+  sa->kind = staged->kind;
+  sa->indexed = staged->indexed;
+  sa->assoc = staged->assoc;
+  staged->indexed = old.indexed;
+  staged->assoc = old.assoc;
+  sa_destroy(staged);
+}
+
+/* Print s inside single quotes, writing each embedded quote as '\'' */
+static void sa_print_quoted(const char *s)
+{
+  putchar('\'');
+  for (; *s != '\0'; s++)
+  {
+    if (*s == '\'')
+    {
+      fputs("'\\''", stdout);
+    }
+    else
+    {
+      putchar(*s);
+    }
+  }
+  putchar('\'');
+}
+
+/* Print the array as `declare -a name=([0]='x' ...)` */
+void sa_print(const ShellArray *sa)
+{
+  printf("declare %s %s=(", sa->kind == ARRAY_ASSOC ? "-A" : "-a", sa->name);
+  if (sa->kind == ARRAY_ASSOC)
+  {
+    const OpenMap *om = sa->assoc;
+    const char *sep = "";
+    for (size_t i = om_next(om, 0); i < om->capacity; i = om_next(om, i + 1))
+    {
+      // keys are quoted only when they hold more than word characters.
+      const char *key = om->slots[i].key;
+      printf("%s[", sep);
+      if (key[strspn(key, SA_PLAIN_KEY_CHARS)] == '\0')
+      {
+        fputs(key, stdout);
+      }
+      else
+      {
+        sa_print_quoted(key);
+      }
+      printf("]=");
+      sa_print_quoted(om->slots[i].value);
+      sep = " ";
+    }
+  }
+  else
+  {
+    for (size_t i = 0; i < sa->indexed->size; i++)
+    {
+      printf("%s[%zu]=", i == 0 ? "" : " ", i);
+      sa_print_quoted(sa->indexed->data[i]);
+    }
+  }
+  printf(")\n");
+}
@@ -0,0 +1,83 @@
+#ifndef SHELL_ARRAY_H
+#define SHELL_ARRAY_H
+
+#include <stddef.h>
+
+#include "dynamic_array.h"
+#include "open_map.h"
+
+#define SA_MAX_GAP 4096 // furthest past the last element an indexed assignment may land
+
+typedef enum {
+    ARRAY_INDEXED, // keys are 0, 1, 2, ... backed by a DynamicArray
+    ARRAY_ASSOC    // arbitrary string keys backed by an OpenMap
+} ArrayKind;
+
+// A named shell array
+typedef struct {
+    char *name;
+    ArrayKind kind;
+    DynamicArray *indexed; // set when kind == ARRAY_INDEXED
+    OpenMap *assoc;        // set when kind == ARRAY_ASSOC
+} ShellArray;
+
+// All arrays defined in the shell, in order of declaration
+typedef struct {
+    ShellArray **arrays;
+    size_t size;
+    size_t capacity;
+} ArrayTable;
+
+// Create a new, empty ArrayTable
+ArrayTable *at_create(void);
+
+// Get array by name (NULL if not found)
+ShellArray *at_get(const ArrayTable *at, const char *name);
+
+// Get array by name, creating an empty one of the given kind if needed.
+// An existing array of a different kind is replaced.
+ShellArray *at_declare(ArrayTable *at, const char *name, ArrayKind kind);
+
+// Delete array with given name
+void at_delete(ArrayTable *at, const char *name);
+
+// Free whole ArrayTable
+void at_free(ArrayTable *at);
+
+// 1 if name is a valid array name ([A-Za-z_][A-Za-z0-9_]*), 0 otherwise
+int sa_valid_name(const char *name, size_t len);
+
+// Check key as a subscript for an array of the given kind with *size elements
+// (indexed only), then update *size as if it was set.
+// Returns 0 if sa_set() would accept it, 1 on a bad subscript
+int sa_check_key(ArrayKind kind, const char *key, size_t *size);
+
+// Set element at key. Returns 0 on success, 1 on a bad subscript
+// (including an index more than SA_MAX_GAP past the end)
+int sa_set(ShellArray *sa, const char *key, const char *value);
+
+// Get element at key (NULL if not set)
+char *sa_get(const ShellArray *sa, const char *key);
+
+// Delete element at key. Returns 0 on success, 1 on a bad subscript.
+// Indexed elements keep their indices: a deleted one before the end is
+// left empty
+int sa_delete(ShellArray *sa, const char *key);
+
+// Number of elements in the array
+size_t sa_length(const ShellArray *sa);
+
+// Append every key (keys != 0) or every value (keys == 0) to out,
+// in iteration order
+void sa_collect(const ShellArray *sa, int keys, DynamicArray *out);
+
+// Detached, empty array to build a new value in
+ShellArray *sa_stage(const char *name, ArrayKind kind);
+
+// Replace sa's kind and elements with staged's, then free staged
+void sa_commit(ShellArray *sa, ShellArray *staged);
+
+// Print the array as a `declare` command that recreates it
+void sa_print(const ShellArray *sa);
+
+#endif // SHELL_ARRAY_H
@@ -4,19 +4,34 @@
 #include <assert.h>
 #include <errno.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/wait.h>
 #include <ctype.h>
+#include <fcntl.h>
 
 #include "dynamic_array.h"
 #include "hash_map.h"
+#include "io_engine.h"
+#include "line_io.h"
+#include "line_sort.h"
+#include "prefetch.h"
+#include "profile.h"
+#include "sched.h"
+#include "shell_array.h"
 #include "utils.h"
 
 int rc;
 HashMap *alias_hm;
 DynamicArray *history_da;
+ArrayTable *array_tbl;
+Prefetcher *prefetcher;
+
+const char *builtins[] = {"exit", "alias", "unalias", "which", "path", "cd", "history",
+                          "declare", "unset", "sort", "uniq"};
+#define NUM_BUILTINS (sizeof(builtins) / sizeof(builtins[0]))
 
 /***************************************************
  * Helper Functions
@@ -37,6 +52,18 @@ void wsh_free(void)
     da_free(history_da);
     history_da = NULL;
   }
+  if (array_tbl != NULL)
+  {
+    at_free(array_tbl);
+    array_tbl = NULL;
+  }
+  if (prefetcher != NULL)
+  {
+    pf_free(prefetcher);
+    prefetcher = NULL;
+  }
+  ioe_shutdown();
+  prof_finish();
 }
 
 /**
@@ -66,6 +93,26 @@ void wsh_warn(const char *msg, ...)
   rc = EXIT_FAILURE;
 }
 
+/**
+ * @Brief Sample the shell's own CPU time when WSH_PROFILE is set to a rate
+ * in Hz. Folded stacks go to WSH_PROFILE_OUT (default wsh.<pid>.folded)
+ * when the shell exits.
+ */
+void start_profiler(void)
+{
+  const char *env = getenv("WSH_PROFILE");
+  if (env == NULL || *env == '\0')
+  {
+    return;
+  }
+  char *end;
+  long hz = strtol(env, &end, 10);
+  if (*end != '\0' || hz < 1 || hz > PROF_MAX_HZ || prof_start(hz, getenv("WSH_PROFILE_OUT")) != 0)
+  {
+    wsh_warn(INVALID_PROFILE, PROF_MAX_HZ);
+  }
+}
+
 /**
  * @Brief Main entry point for the shell
  *
@@ -75,8 +122,10 @@ void wsh_warn(const char *msg, ...)
  */
 int main(int argc, char **argv)
 {
+  start_profiler();
   alias_hm = hm_create();
   history_da = da_create(10);
+  array_tbl = at_create();
   setenv("PATH", "/bin", 1);
   if (argc > 2)
   {
@@ -372,8 +421,7 @@ int which_command(char *argv[], int argc)
   }
 
   // check if command is builtin.
-  char *builtins[7] = {"exit", "alias", "unalias", "which", "path", "cd", "history"};
-  for (int i = 0; i < 7; i++)
+  for (size_t i = 0; i < NUM_BUILTINS; i++)
   {
     if (strcmp(builtins[i], argv[1]) == 0)
     {
@@ -540,162 +588,868 @@ int show_history(char *argv[], int argc)
 }
 
 /**
- * @brief Execute command matching any builtins.
+ * @brief split an array reference of the form `name` or `name[key]`.
  * 
- * @param argv args from user input
+ * @param ref the reference (need not be NUL-terminated after len chars)
+ * @param len number of characters in ref.
+ * @param name_len set to the length of the name part.
+ * @param key set to a newly allocated copy of the key, NULL if no subscript.
+ * @return 0 if ref is a valid reference, 1 otherwise.
+ */
+int split_array_ref(const char *ref, size_t len, size_t *name_len, char **key)
+{
+  const char *bracket = memchr(ref, '[', len);
+  *key = NULL;
+  if (bracket == NULL)
+  {
+    *name_len = len;
+    return !sa_valid_name(ref, len);
+  }
+
+  *name_len = bracket - ref;
+  if (ref[len - 1] != ']' || !sa_valid_name(ref, *name_len))
+  {
+    return 1;
+  }
+  *key = strndup(bracket + 1, len - *name_len - 2);
+  return 0;
+}
+
+/**
+ * @brief assign a single element (`name[key]=value` or `name[key]+=value`).
+ *        Creates an indexed array if `name` does not exist yet.
+ * 
+ * @param name name of the array
+ * @param key subscript to assign to
+ * @param value value to store
+ * @param append_value if 1, append value to the current element instead.
+ * @return 0 if successfully assigned, 1 if failed.
+ */
+int assign_array_element(const char *name, const char *key, const char *value, int append_value)
+{
+  ShellArray *sa = at_get(array_tbl, name);
+  if (sa == NULL)
+  {
+    sa = at_declare(array_tbl, name, ARRAY_INDEXED);
+  }
+
+  char *new_value = strdup(value);
+  const char *old_value;
+  if (append_value && (old_value = sa_get(sa, key)) != NULL)
+  {
+    free(new_value);
+    new_value = strdup(old_value);
+    new_value = append(new_value, value);
+  }
+
+  int res = sa_set(sa, key, new_value);
+  if (res != 0)
+  {
+    wsh_warn(BAD_ARRAY_SUBSCRIPT, name);
+  }
+  free(new_value);
+  return res;
+}
+
+/**
+ * @brief assign a list of elements (`name=(v1 [key]=v2 ...)`, or `+=` to
+ *        keep the existing elements). Elements without a subscript go after
+ *        the last assigned index of an indexed array.
+ * 
+ * @param name name of the array
+ * @param argv args from user input; argv[0] is `name=(...` and
+ *             the last arg ends with `)`.
  * @param argc number of args in user input
- * @return 0 if success
- *         1 if error
- *         2 if must exit.
- *        -1 if builtin not found.
+ * @param list_start start of the first element within argv[0]
+ * @param append_list if 1, keep the elements already in the array.
+ * @return 0 if successfully assigned, 1 if failed.
  */
-int execute_builtin(char *argv[], int argc)
+int assign_array_list(const char *name, char *argv[], int argc, const char *list_start, int append_list)
 {
-  int res;
-  if (argc == 0)
+  const char *last = (argc == 1) ? list_start : argv[argc - 1];
+  size_t last_len = strlen(last);
+  if (last_len == 0 || last[last_len - 1] != ')')
   {
-    res = 0;
+    wsh_warn(INVALID_ARRAY_ASSIGN, argv[0]);
+    return 1;
   }
-  else if (strcmp(argv[0], "exit") == 0)
+
+  ShellArray *current = at_get(array_tbl, name);
+  ArrayKind kind = current != NULL ? current->kind : ARRAY_INDEXED;
+
+  // check every element before setting any, so a bad one leaves the array
+  // as it was. Only the new elements are collected: `+=` stays O(new).
+  DynamicArray *keys = da_create(8);
+  DynamicArray *values = da_create(8);
+  size_t size = (append_list && current != NULL) ? sa_length(current) : 0;
+  size_t next_index = size;
+  int res = 0;
+  for (int i = 0; i < argc && res == 0; i++)
   {
-    res = exit_shell(argc);
+    const char *token = (i == 0) ? list_start : argv[i];
+    size_t len = strlen(token);
+    if (i == argc - 1)
+    {
+      len--; // drop the closing ')'
+    }
+    // `name=(` and `)` on their own carry no element.
+    if (len == 0 && (i == 0 || (i == argc - 1 && strcmp(token, ")") == 0)))
+    {
+      continue;
+    }
+
+    char *element = strndup(token, len);
+    char *close = strstr(element, "]=");
+    char index[32];
+    char *key = NULL;
+    char *value = element;
+    if (element[0] == '[' && close != NULL)
+    {
+      *close = '\0';
+      key = element + 1;
+      value = close + 2;
+    }
+    else if (kind == ARRAY_INDEXED)
+    {
+      snprintf(index, sizeof(index), "%zu", next_index);
+      key = index;
+    }
+    // associative arrays need a key for every element.
+    res = key == NULL || sa_check_key(kind, key, &size) != 0;
     if (res == 0)
     {
-      return 2;
+      if (kind == ARRAY_INDEXED)
+      {
+        next_index = strtoul(key, NULL, 10) + 1;
+      }
+      da_put(keys, key);
+      da_put(values, value);
     }
+    free(element);
   }
-  else if (strcmp(argv[0], "alias") == 0)
+
+  if (res != 0)
   {
-    res = create_alias(argv, argc);
-    if (res == 1)
-    {
-      wsh_warn(INVALID_ALIAS_USE);
-    }
+    wsh_warn(BAD_ARRAY_SUBSCRIPT, name);
   }
-  else if (strcmp(argv[0], "unalias") == 0)
+  else
   {
-    res = unalias(argv, argc);
-    if (res == 1)
+    // `+=` adds to the array in place; `=` builds the new contents aside.
+    ShellArray *sa = append_list ? at_declare(array_tbl, name, kind) : sa_stage(name, kind);
+    for (size_t i = 0; i < keys->size; i++)
     {
-      wsh_warn(INVALID_UNALIAS_USE);
+      sa_set(sa, keys->data[i], values->data[i]);
+    }
+    if (!append_list)
+    {
+      sa_commit(at_declare(array_tbl, name, kind), sa);
     }
   }
-  else if (strcmp(argv[0], "which") == 0)
+  da_free(keys);
+  da_free(values);
+  return res;
+}
+
+/**
+ * @brief handle array assignments:
+ *        `name=(...)`, `name+=(...)`, `name[key]=value`, `name[key]+=value`.
+ *        A value containing spaces can be given as `name[key]= 'a b'`.
+ * 
+ * @param argv args from user input
+ * @param argc number of args in user input
+ * @return 0 if successfully assigned, 1 if failed, -1 if not an assignment.
+ */
+int assign_array(char *argv[], int argc)
+{
+  char *equals = strchr(argv[0], '=');
+  if (equals == NULL || equals == argv[0])
   {
-    res = which_command(argv, argc);
+    return -1;
   }
-  else if (strcmp(argv[0], "path") == 0)
+
+  size_t lhs_len = equals - argv[0];
+  int append_mode = 0;
+  if (argv[0][lhs_len - 1] == '+')
   {
-    res = path_set_and_get(argv, argc);
+    append_mode = 1;
+    lhs_len--;
   }
-  else if (strcmp(argv[0], "cd") == 0)
+
+  size_t name_len;
+  char *key;
+  if (lhs_len == 0 || split_array_ref(argv[0], lhs_len, &name_len, &key) != 0)
   {
-    res = change_directory(argv, argc);
+    return -1;
   }
-  else if (strcmp(argv[0], "history") == 0)
+  if (key == NULL && equals[1] != '(')
   {
-    res = show_history(argv, argc);
+    return -1; // plain `name=value`, not an array.
+  }
+
+  char *name = strndup(argv[0], name_len);
+  int res;
+  if (key != NULL)
+  {
+    const char *value = equals + 1;
+    if (*value == '\0' && argc == 2)
+    {
+      value = argv[1];
+    }
+    else if (argc != 1)
+    {
+      wsh_warn(INVALID_ARRAY_ASSIGN, argv[0]);
+      free(name);
+      free(key);
+      return 1;
+    }
+    res = assign_array_element(name, key, value, append_mode);
+    free(key);
   }
   else
   {
-    res = -1;
+    res = assign_array_list(name, argv, argc, equals + 2, append_mode);
   }
+  free(name);
   return res;
 }
 
 /**
- * @brief check whether a command is builtin or not.
+ * @brief handle builtin `declare` to create arrays or list them.
+ *        `-a` declares indexed arrays, `-A` associative ones.
  * 
- * @param cmd name of command
- * @return 0 if cmd is a builtin, 1 if not
+ * @param argv args from user input
+ * @param argc number of args in user input
+ * @return 0 if successfully declared/listed arrays, 1 if failed.
  */
-int is_builtin_command(char *cmd)
+int declare_arrays(char *argv[], int argc)
 {
-  if (cmd == NULL)
+  if (argc == 1)
+  {
+    for (size_t i = 0; i < array_tbl->size; i++)
+    {
+      sa_print(array_tbl->arrays[i]);
+    }
     return 0;
-  const char *builtins[] = {"exit", "alias", "unalias", "which", "path", "cd", "history"};
-  for (int i = 0; i < 7; i++)
+  }
+
+  ArrayKind kind;
+  if (strcmp(argv[1], "-a") == 0)
   {
-    if (strcmp(cmd, builtins[i]) == 0)
+    kind = ARRAY_INDEXED;
+  }
+  else if (strcmp(argv[1], "-A") == 0)
+  {
+    kind = ARRAY_ASSOC;
+  }
+  else
+  {
+    wsh_warn(INVALID_DECLARE_USE);
+    return 1;
+  }
+
+  // `declare -a` / `declare -A` list arrays of that kind.
+  if (argc == 2)
+  {
+    for (size_t i = 0; i < array_tbl->size; i++)
     {
-      return 0;
+      if (array_tbl->arrays[i]->kind == kind)
+      {
+        sa_print(array_tbl->arrays[i]);
+      }
     }
+    return 0;
   }
-  return 1;
-}
 
-/***************************************************
- * Modes of Execution
- ***************************************************/
+  for (int i = 2; i < argc; i++)
+  {
+    if (!sa_valid_name(argv[i], strlen(argv[i])))
+    {
+      wsh_warn(INVALID_DECLARE_USE);
+      return 1;
+    }
+    at_declare(array_tbl, argv[i], kind);
+  }
+  return 0;
+}
 
 /**
- * @Brief Interactive mode: print prompt and wait for user input
- * execute the given input and repeat
+ * @brief handle builtin `unset` to delete arrays or single elements.
+ * 
+ * @param argv args from user input
+ * @param argc number of args in user input
+ * @return 0 if successfully unset, 1 if failed.
  */
-void interactive_main(void)
+int unset_arrays(char *argv[], int argc)
 {
-  char *argv[MAX_ARGS];
-  int argc;
+  if (argc < 2)
+  {
+    wsh_warn(INVALID_UNSET_USE);
+    return 1;
+  }
 
-  while (1)
+  int res = 0;
+  for (int i = 1; i < argc; i++)
   {
-    while (wait(NULL) > 0)
+    size_t name_len;
+    char *key;
+    if (split_array_ref(argv[i], strlen(argv[i]), &name_len, &key) != 0)
     {
-      // Wait until all children finish executing.
+      wsh_warn(INVALID_UNSET_USE);
+      res = 1;
+      continue;
     }
 
-    printf("%s", PROMPT);
-    fflush(stdout);
-
-    char input[MAX_LINE + 1];
-    if (fgets(input, sizeof(input), stdin) == NULL)
+    char *name = strndup(argv[i], name_len);
+    ShellArray *sa;
+    if (key == NULL)
     {
-      printf("exit\n");
-      break;
+      at_delete(array_tbl, name);
+    }
+    else if ((sa = at_get(array_tbl, name)) != NULL && sa_delete(sa, key) != 0)
+    {
+      wsh_warn(BAD_ARRAY_SUBSCRIPT, name);
+      res = 1;
     }
+    free(name);
+    free(key);
+  }
+  return res;
+}
 
-    // parse commands and store into commands array.
-    char *commands[MAX_ARGS];
-    int num_commands = 0;
-    char *input_copy = input;
-    char *input_dup_for_history = strdup(input);
-    char *subcommand;
+/**
+ * @brief parse a `sort -S` memory size. A plain number is in KiB;
+ *        suffixes b, K, M and G select bytes, KiB, MiB and GiB.
+ * 
+ * @param arg the size as given by the user
+ * @param size set to the size in bytes
+ * @return 0 if arg is a valid size, 1 otherwise (including sizes too
+ *         big to count in bytes).
+ */
+int parse_mem_size(const char *arg, size_t *size)
+{
+  if (!isdigit((unsigned char)arg[0]))
+  {
+    return 1;
+  }
+  char *endptr;
+  errno = 0;
+  unsigned long long n = strtoull(arg, &endptr, 10);
+  if (errno == ERANGE || (endptr[0] != '\0' && endptr[1] != '\0'))
+  {
+    return 1;
+  }
+  int shift;
+  switch (*endptr)
+  {
+  case 'b':
+    shift = 0;
+    break;
+  case '\0':
+  case 'K':
+  case 'k':
+    shift = 10;
+    break;
+  case 'M':
+  case 'm':
+    shift = 20;
+    break;
+  case 'G':
+  case 'g':
+    shift = 30;
+    break;
+  default:
+    return 1;
+  }
+  if (n > (SIZE_MAX >> shift))
+  {
+    return 1;
+  }
+  *size = (size_t)n << shift;
+  return 0;
+}
 
-    // count number of commands separated by `|`
-    while ((subcommand = strsep(&input_copy, "|")) != NULL && num_commands < MAX_ARGS)
+/**
+ * @brief close the file descriptors opened by open_inputs().
+ * 
+ * @param fds file descriptors to close (stdin is left open)
+ * @param num_fds number of file descriptors
+ */
+void close_inputs(int fds[], int num_fds)
+{
+  for (int i = 0; i < num_fds; i++)
+  {
+    if (fds[i] != STDIN_FILENO)
     {
-      commands[num_commands++] = subcommand;
+      close(fds[i]);
     }
+  }
+}
 
-    // user just pressed 'Enter'.
-    if (num_commands == 0)
+/**
+ * @brief open the input files of a filter builtin (`-` is stdin).
+ *        With no files, stdin is the only input.
+ * 
+ * @param files names of the input files
+ * @param num_files number of input files
+ * @param fds receives one file descriptor per input (num_files or 1 entries)
+ * @return number of file descriptors in fds, -1 if a file can't be opened.
+ */
+int open_inputs(char *files[], int num_files, int fds[])
+{
+  if (num_files == 0)
+  {
+    fds[0] = STDIN_FILENO;
+    return 1;
+  }
+  for (int i = 0; i < num_files; i++)
+  {
+    fds[i] = (strcmp(files[i], "-") == 0) ? STDIN_FILENO : open(files[i], O_RDONLY);
+    if (fds[i] < 0)
     {
-      free(input_dup_for_history);
-      continue;
+      perror(files[i]);
+      close_inputs(fds, i);
+      return -1;
     }
+  }
+  return num_files;
+}
 
-    // I need to do this otherwise the external command
-    // will print its output before a previously executed
-    // builtin command.
-    fflush(stdout);
-    fflush(stderr);
+/**
+ * @brief handle builtin `sort` to sort lines in-process.
+ *        Sorts with one thread per CPU and spills sorted runs to temp
+ *        files once the memory budget (-S) is used up.
+ *        Options it doesn't implement (eg: -k, -u, -t) are left to the
+ *        external sort.
+ * 
+ * @param argv args from user input
+ * @param argc number of args in user input
+ * @return 0 if successfully sorted, 1 if failed,
+ *        -1 if an option is not supported by the builtin.
+ */
+int sort_input(char *argv[], int argc)
+{
+  SortOptions opts;
+  sort_default_options(&opts);
 
-    // handle single command (no piping)
-    if (num_commands == 1)
+  int i = 1;
+  for (; i < argc && argv[i][0] == '-' && argv[i][1] != '\0'; i++)
+  {
+    if (strncmp(argv[i], "--parallel=", 11) == 0)
     {
-      parseline_no_subst(commands[0], argv, &argc);
-      substitute_alias(argv, &argc);
-
-      // aliased to nothing. (eg: alias test = '')
-      if (argc == 0)
+      char *endptr;
+      long threads = strtol(argv[i] + 11, &endptr, 10);
+      if (*endptr != '\0' || threads < 1)
       {
-        da_put(history_da, input_dup_for_history);
-        free(input_dup_for_history);
-        free_argv(argv, argc);
-        continue;
+        wsh_warn(INVALID_SORT_USE);
+        return 1;
       }
-
-      int res = execute_builtin(argv, argc);
+      opts.threads = threads;
+      continue;
+    }
+    for (char *flag = argv[i] + 1; *flag != '\0'; flag++)
+    {
+      if (*flag == 'r')
+      {
+        opts.reverse = 1;
+      }
+      else if (*flag == 'n')
+      {
+        opts.numeric = 1;
+      }
+      else if (*flag == 'S')
+      {
+        // size is either the rest of this arg (-S64M) or the next one.
+        const char *size = (flag[1] != '\0') ? flag + 1 : argv[++i];
+        if (size == NULL || parse_mem_size(size, &opts.mem_limit) != 0)
+        {
+          wsh_warn(INVALID_SORT_USE);
+          return 1;
+        }
+        break;
+      }
+      else
+      {
+        return -1;
+      }
+    }
+  }
+
+  int fds[MAX_ARGS];
+  int num_fds = open_inputs(argv + i, argc - i, fds);
+  if (num_fds < 0)
+  {
+    return 1;
+  }
+  fflush(stdout);
+  int res = sort_fds(fds, num_fds, STDOUT_FILENO, &opts);
+  if (res != 0)
+  {
+    perror("sort");
+  }
+  close_inputs(fds, num_fds);
+  return res == 0 ? 0 : 1;
+}
+
+/**
+ * @brief handle builtin `uniq` to drop repeated adjacent lines in-process.
+ *        Streams its input, so only the current and previous line are held.
+ *        Options other than -c (eg: -d, -i) are left to the external uniq.
+ * 
+ * @param argv args from user input
+ * @param argc number of args in user input
+ * @return 0 if success, 1 if failed,
+ *        -1 if an option is not supported by the builtin.
+ */
+int uniq_input(char *argv[], int argc)
+{
+  int count = 0;
+  int i = 1;
+  if (i < argc && strcmp(argv[i], "-c") == 0)
+  {
+    count = 1;
+    i++;
+  }
+  if (i < argc && argv[i][0] == '-' && argv[i][1] != '\0')
+  {
+    return -1;
+  }
+  if (argc - i > 1)
+  {
+    wsh_warn(INVALID_UNIQ_USE);
+    return 1;
+  }
+
+  int fd;
+  if (open_inputs(argv + i, argc - i, &fd) < 0)
+  {
+    return 1;
+  }
+  fflush(stdout);
+
+  LineReader lr;
+  LineWriter lw;
+  // a file we opened is ours alone: read it ahead at explicit offsets.
+  lr_init(&lr, fd, fd != STDIN_FILENO);
+  lw_init(&lw, STDOUT_FILENO, 0);
+
+  char *prev = NULL;
+  size_t prev_len = 0;
+  size_t prev_cap = 0;
+  long repeats = 0;
+  char *line;
+  ssize_t len;
+  while (lw.error == 0)
+  {
+    len = lr_next(&lr, &line);
+    if (repeats > 0 && (len < 0 || (size_t)len != prev_len || memcmp(line, prev, len) != 0))
+    {
+      // the previous group ended: emit it.
+      if (count)
+      {
+        char prefix[32];
+        int n = snprintf(prefix, sizeof(prefix), "%7ld ", repeats);
+        lw_write(&lw, prefix, n);
+      }
+      lw_line(&lw, prev, prev_len);
+      repeats = 0;
+    }
+    if (len < 0)
+    {
+      break;
+    }
+    if (repeats++ == 0)
+    {
+      if ((size_t)len + 1 > prev_cap)
+      {
+        prev_cap = len + 1;
+        prev = realloc(prev, prev_cap);
+      }
+      memcpy(prev, line, len + 1);
+      prev_len = len;
+    }
+  }
+
+  int res = 0;
+  if (lw_free(&lw) != 0 || lr.error != 0)
+  {
+    errno = lr.error != 0 ? lr.error : lw.error;
+    perror("uniq");
+    res = 1;
+  }
+  free(prev);
+  lr_free(&lr);
+  close_inputs(&fd, 1);
+  return res;
+}
+
+/**
+ * @brief Execute command matching any builtins.
+ * 
+ * @param argv args from user input
+ * @param argc number of args in user input
+ * @return 0 if success
+ *         1 if error
+ *         2 if must exit.
+ *        -1 if builtin not found (or it leaves the line to the
+ *           external command of the same name).
+ */
+int execute_builtin(char *argv[], int argc)
+{
+  int res;
+  if (argc == 0)
+  {
+    res = 0;
+  }
+  else if (strcmp(argv[0], "exit") == 0)
+  {
+    res = exit_shell(argc);
+    if (res == 0)
+    {
+      return 2;
+    }
+  }
+  else if (strcmp(argv[0], "alias") == 0)
+  {
+    res = create_alias(argv, argc);
+    if (res == 1)
+    {
+      wsh_warn(INVALID_ALIAS_USE);
+    }
+  }
+  else if (strcmp(argv[0], "unalias") == 0)
+  {
+    res = unalias(argv, argc);
+    if (res == 1)
+    {
+      wsh_warn(INVALID_UNALIAS_USE);
+    }
+  }
+  else if (strcmp(argv[0], "which") == 0)
+  {
+    res = which_command(argv, argc);
+  }
+  else if (strcmp(argv[0], "path") == 0)
+  {
+    res = path_set_and_get(argv, argc);
+  }
+  else if (strcmp(argv[0], "cd") == 0)
+  {
+    res = change_directory(argv, argc);
+  }
+  else if (strcmp(argv[0], "history") == 0)
+  {
+    res = show_history(argv, argc);
+  }
+  else if (strcmp(argv[0], "declare") == 0)
+  {
+    res = declare_arrays(argv, argc);
+  }
+  else if (strcmp(argv[0], "unset") == 0)
+  {
+    res = unset_arrays(argv, argc);
+  }
+  else if (strcmp(argv[0], "sort") == 0)
+  {
+    res = sort_input(argv, argc);
+  }
+  else if (strcmp(argv[0], "uniq") == 0)
+  {
+    res = uniq_input(argv, argc);
+  }
+  else if ((res = assign_array(argv, argc)) != -1)
+  {
+    // array assignment (eg: `a=(x y z)` or `m[key]=value`)
+  }
+  else
+  {
+    res = -1;
+  }
+  return res;
+}
+
+/**
+ * @brief check whether a command is builtin or not.
+ * 
+ * @param cmd name of command
+ * @return 0 if cmd is a builtin, 1 if not
+ */
+int is_builtin_command(char *cmd)
+{
+  if (cmd == NULL)
+    return 0;
+  for (size_t i = 0; i < NUM_BUILTINS; i++)
+  {
+    if (strcmp(cmd, builtins[i]) == 0)
+    {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/***************************************************
+ * Prefetching
+ ***************************************************/
+
+/**
+ * @brief Create the batch mode prefetcher from WSH_PREFETCH (lines to look
+ * ahead, 0 to disable) and WSH_PREFETCH_LIBS (0 to skip shared libraries).
+ *
+ * @param script_file Path to the script file
+ * @return the Prefetcher, NULL if prefetching is disabled
+ */
+Prefetcher *create_prefetcher(const char *script_file)
+{
+  int lookahead = PREFETCH_DEFAULT_LOOKAHEAD;
+  const char *env = getenv("WSH_PREFETCH");
+  if (env != NULL && *env != '\0')
+  {
+    char *end;
+    long value = strtol(env, &end, 10);
+    if (*end != '\0' || value < 0 || value > MAX_LINE)
+    {
+      value = PREFETCH_DEFAULT_LOOKAHEAD;
+    }
+    lookahead = value;
+  }
+  if (lookahead == 0)
+  {
+    return NULL;
+  }
+  env = getenv("WSH_PREFETCH_LIBS");
+  int follow_libs = env == NULL || strcmp(env, "0") != 0;
+  return pf_create(script_file, lookahead, follow_libs);
+}
+
+/**
+ * @brief Prefetch the binary a pipeline segment will run, without printing
+ * anything. Aliases are followed; builtins and assignments have no binary.
+ *
+ * @param segment one `|`-separated part of a script line
+ * @param budget most bytes of readahead to issue
+ * @return bytes of readahead issued
+ */
+size_t prefetch_segment(const char *segment, size_t budget)
+{
+  char *argv[MAX_ARGS];
+  int argc;
+  parseline_quiet(segment, argv, &argc);
+
+  size_t used = 0;
+  if (argc > 0 && is_builtin_command(argv[0]) == 1 && strchr(argv[0], '=') == NULL)
+  {
+    const char *path = pf_resolve(prefetcher, argv[0]);
+    if (path != NULL)
+    {
+      used = pf_file(prefetcher, path, budget);
+    }
+  }
+  free_argv(argv, argc);
+  return used;
+}
+
+/**
+ * @brief Prefetch the binaries (and their libraries) of the script lines
+ * after the one being run, up to the lookahead. Called while the shell
+ * would otherwise sit in waitpid().
+ *
+ * @param lines_read number of script lines read so far
+ */
+void prefetch_upcoming(long lines_read)
+{
+  if (prefetcher == NULL)
+  {
+    return;
+  }
+  char line[MAX_LINE + 1];
+  size_t budget = PREFETCH_BUDGET;
+  while (budget > 0 && prefetcher->scan_line < lines_read + prefetcher->lookahead &&
+         pf_read_line(prefetcher, line, sizeof(line)) > 0)
+  {
+    if (prefetcher->scan_line <= lines_read)
+    {
+      continue; // already run.
+    }
+    char *line_copy = line;
+    char *segment;
+    while (budget > 0 && (segment = strsep(&line_copy, "|")) != NULL)
+    {
+      budget -= prefetch_segment(segment, budget);
+    }
+  }
+}
+
+/***************************************************
+ * Modes of Execution
+ ***************************************************/
+
+/**
+ * @Brief Interactive mode: print prompt and wait for user input
+ * execute the given input and repeat
+ */
+void interactive_main(void)
+{
+  char *argv[MAX_ARGS];
+  int argc;
+
+  while (1)
+  {
+    while (wait(NULL) > 0)
+    {
+      // Wait until all children finish executing.
+    }
+
+    printf("%s", PROMPT);
+    fflush(stdout);
+
+    char input[MAX_LINE + 1];
+    if (fgets(input, sizeof(input), stdin) == NULL)
+    {
+      printf("exit\n");
+      break;
+    }
+
+    // parse commands and store into commands array.
+    char *commands[MAX_ARGS];
+    int num_commands = 0;
+    char *input_copy = input;
+    char *input_dup_for_history = strdup(input);
+    char *subcommand;
+
+    // count number of commands separated by `|`
+    while ((subcommand = strsep(&input_copy, "|")) != NULL && num_commands < MAX_ARGS)
+    {
+      commands[num_commands++] = subcommand;
+    }
+
+    // user just pressed 'Enter'.
+    if (num_commands == 0)
+    {
+      free(input_dup_for_history);
+      continue;
+    }
+
+    // I need to do this otherwise the external command
+    // will print its output before a previously executed
+    // builtin command.
+    fflush(stdout);
+    fflush(stderr);
+
+    // handle single command (no piping)
+    if (num_commands == 1)
+    {
+      parseline(commands[0], argv, &argc);
+
+      // aliased to nothing. (eg: alias test = '')
+      if (argc == 0)
+      {
+        da_put(history_da, input_dup_for_history);
+        free(input_dup_for_history);
+        free_argv(argv, argc);
+        continue;
+      }
+
+      int res = execute_builtin(argv, argc);
       if (res == 2) // 'exit' builtin.
       {
         free(input_dup_for_history);
@@ -741,10 +1495,12 @@ void interactive_main(void)
       {
         char *command_path = NULL;
 
-        parseline_no_subst(commands[i], argv, &argc);
-        substitute_alias(argv, &argc);
-
-        if (argc == 0)
+        // a bad substitution is already reported and empties the segment.
+        if (parseline(commands[i], argv, &argc) != 0)
+        {
+          is_valid_pipeline = 0;
+        }
+        else if (argc == 0)
         {
           is_valid_pipeline = 0;
           wsh_warn(EMPTY_PIPE_SEGMENT);
@@ -802,8 +1558,7 @@ void interactive_main(void)
               close(pipes[j][1]);
             }
 
-            parseline_no_subst(commands[i], argv, &argc);
-            substitute_alias(argv, &argc);
+            parseline(commands[i], argv, &argc);
             if (argc == 0)
             {
               wsh_warn(EMPTY_PIPE_SEGMENT);
@@ -815,9 +1570,10 @@ void interactive_main(void)
             int res = execute_builtin(argv, argc);
             if (res == 0 || res == 1 || res == 2)
             {
+              // a failed builtin (eg: sort of a missing file) fails the segment.
               free_argv(argv, argc);
               free(input_dup_for_history);
-              clean_exit(EXIT_SUCCESS);
+              clean_exit(res == 1 ? EXIT_FAILURE : EXIT_SUCCESS);
             }
 
             char *full_path = get_command_path(argv[0]);
@@ -845,91 +1601,196 @@ void interactive_main(void)
 }
 
 /**
- * @Brief Batch mode: read commands from script file line by line
- * execute each command and repeat until EOF
+ * @Brief Execute one line of a batch script
  *
- * @param script_file Path to the script file
- * @return EXIT_SUCCESS(0) on success, EXIT_FAILURE(1) on error
+ * @param line The line, split in place
+ * @param sfp The script file (closed in forked children)
+ * @param lines_read Number of script lines read so far
+ * @param final_status Set to the exit status of the line
+ * @return 1 if the line ran `exit`, 0 otherwise
  */
-
-int batch_main(const char *script_file)
+int execute_batch_line(char *line, FILE *sfp, long lines_read, int *final_status)
 {
-  FILE *sfp = fopen(script_file, "r");
-  if (sfp == NULL)
+  char *argv[MAX_ARGS];
+  int argc;
+
+  // parse commands and store into commands array.
+  char *commands[MAX_ARGS];
+  int num_commands = 0;
+  char *line_copy = line;
+  char *line_dup_for_history = strdup(line);
+  char *subcommand;
+  while ((subcommand = strsep(&line_copy, "|")) != NULL && num_commands < MAX_ARGS)
   {
-    perror("fopen");
-    clean_exit(EXIT_FAILURE);
+    commands[num_commands++] = subcommand;
   }
 
-  char line[MAX_LINE + 1];
-  char *argv[MAX_ARGS];
-  int argc;
-  int final_status = 0;
+  // Blank line.
+  if (num_commands == 0)
+  {
+    free(line_dup_for_history);
+    return 0;
+  }
 
-  while (fgets(line, sizeof(line), sfp) != NULL)
+  // I need to do this otherwise the current external command
+  // will print its output before a previously executed
+  // builtin command.
+  fflush(stdout);
+  fflush(stderr);
+
+  // handle single command (no piping)
+  if (num_commands == 1)
   {
-    // parse commands and store into commands array.
-    char *commands[MAX_ARGS];
-    int num_commands = 0;
-    char *line_copy = line;
-    char *line_dup_for_history = strdup(line);
-    char *subcommand;
-    while ((subcommand = strsep(&line_copy, "|")) != NULL && num_commands < MAX_ARGS)
-    {
-      commands[num_commands++] = subcommand;
-    }
+    parseline(commands[0], argv, &argc);
 
-    // Blank line.
-    if (num_commands == 0)
+    if (argc == 0)
     {
+      da_put(history_da, line_dup_for_history);
+      free_argv(argv, argc);
       free(line_dup_for_history);
-      continue;
+      return 0;
     }
 
-    // I need to do this otherwise the current external command
-    // will print its output before a previously executed
-    // builtin command.
-    fflush(stdout);
-    fflush(stderr);
+    int res = execute_builtin(argv, argc);
 
-    // handle single command (no piping)
-    if (num_commands == 1)
+    if (res == 2) // 'exit' builtin.
     {
-      parseline_no_subst(commands[0], argv, &argc);
-      substitute_alias(argv, &argc);
-
-      if (argc == 0)
+      free_argv(argv, argc);
+      free(line_dup_for_history);
+      return 1;
+    }
+    else if (res == 1 || res == 0) // all other builtins
+    {
+      *final_status = res;
+    }
+    else
+    {
+      // Execute single external command.
+      int pid = fork();
+      if (pid < 0)
       {
-        da_put(history_da, line_dup_for_history);
-        free_argv(argv, argc);
+        perror("fork");
+      }
+      else if (pid == 0)
+      {
+        fclose(sfp);
+        char *full_path = get_command_path(argv[0]);
+        if (full_path != NULL)
+        {
+          execv(full_path, argv);
+          free(full_path);
+        }
         free(line_dup_for_history);
-        continue;
+        free_argv(argv, argc);
+        clean_exit(EXIT_FAILURE);
       }
+      else
+      {
+        // warm up the next commands while this one runs.
+        prefetch_upcoming(lines_read);
+
+        // change parent's exit status to
+        // whatever the child's exit status was.
+        int status;
+        waitpid(pid, &status, 0);
+        if (WIFEXITED(status))
+        {
+          *final_status = WEXITSTATUS(status);
+        }
+      }
+    }
+    free_argv(argv, argc);
+  }
+  else // handle piping (num_commands > 1)
+  {
+    int is_valid_pipeline = 1;
 
-      int res = execute_builtin(argv, argc);
+    // Validate if commands exist.
+    for (int i = 0; i < num_commands; i++)
+    {
+      char *command_path = NULL;
 
-      if (res == 2) // 'exit' builtin.
+      // a bad substitution is already reported and empties the segment.
+      if (parseline(commands[i], argv, &argc) != 0)
       {
-        free_argv(argv, argc);
-        free(line_dup_for_history);
-        fclose(sfp);
-        return final_status;
+        is_valid_pipeline = 0;
       }
-      else if (res == 1 || res == 0) // all other builtins
+      else if (argc == 0)
       {
-        final_status = res;
+        is_valid_pipeline = 0;
+        wsh_warn(EMPTY_PIPE_SEGMENT);
       }
-      else
+      else if (is_builtin_command(argv[0]) == 1 && (command_path = get_command_path(argv[0])) == NULL)
       {
-        // Execute single external command.
-        int pid = fork();
-        if (pid < 0)
+        is_valid_pipeline = 0;
+      }
+
+      free_argv(argv, argc);
+      free(command_path);
+    }
+
+    if (is_valid_pipeline)
+    {
+      // Create all pipes.
+      int num_pipes = num_commands - 1;
+      int pipes[num_pipes][2];
+      for (int i = 0; i < num_pipes; i++)
+      {
+        if (pipe(pipes[i]) < 0)
+        {
+          perror("pipe");
+          break;
+        }
+      }
+
+      // Start all child processes.
+      pid_t pids[num_commands];
+      for (int i = 0; i < num_commands; i++)
+      {
+        pids[i] = fork();
+        if (pids[i] < 0)
         {
           perror("fork");
+          break;
         }
-        else if (pid == 0)
+        else if (pids[i] == 0)
         {
           fclose(sfp);
+          // first command should read from regular stdin
+          if (i > 0)
+          {
+            dup2(pipes[i - 1][0], STDIN_FILENO);
+          }
+          // last command should write to regular stdout
+          if (i < num_commands - 1)
+          {
+            dup2(pipes[i][1], STDOUT_FILENO);
+          }
+
+          for (int j = 0; j < num_pipes; j++)
+          {
+            close(pipes[j][0]);
+            close(pipes[j][1]);
+          }
+
+          parseline(commands[i], argv, &argc);
+          if (argc == 0)
+          {
+            wsh_warn(EMPTY_PIPE_SEGMENT);
+            free(line_dup_for_history);
+            free_argv(argv, argc);
+            clean_exit(EXIT_FAILURE);
+          }
+
+          int res = execute_builtin(argv, argc);
+          if (res == 0 || res == 1 || res == 2)
+          {
+            // a failed builtin (eg: sort of a missing file) fails the segment.
+            free_argv(argv, argc);
+            free(line_dup_for_history);
+            clean_exit(res == 1 ? EXIT_FAILURE : EXIT_SUCCESS);
+          }
+
           char *full_path = get_command_path(argv[0]);
           if (full_path != NULL)
           {
@@ -940,141 +1801,360 @@ int batch_main(const char *script_file)
           free_argv(argv, argc);
           clean_exit(EXIT_FAILURE);
         }
-        else
+      }
+
+      for (int i = 0; i < num_pipes; i++)
+      {
+        close(pipes[i][0]);
+        close(pipes[i][1]);
+      }
+
+      prefetch_upcoming(lines_read);
+
+      // parent wait for every child to finish before reading next line.
+      for (int i = 0; i < num_commands; i++)
+      {
+        int status;
+        waitpid(pids[i], &status, 0);
+        // only get the exit status of the last command.
+        if (i == num_commands - 1 && WIFEXITED(status))
         {
-          // change parent's exit status to
-          // whatever the child's exit status was.
-          int status;
-          waitpid(pid, &status, 0);
-          if (WIFEXITED(status))
-          {
-            final_status = WEXITSTATUS(status);
-          }
+          *final_status = WEXITSTATUS(status);
         }
       }
-      free_argv(argv, argc);
     }
-    else // handle piping (num_commands > 1)
+  }
+  da_put(history_da, line_dup_for_history);
+  free(line_dup_for_history);
+  return 0;
+}
+
+/**
+ * @Brief Number of lines to run at once in batch mode, from WSH_JOBS.
+ * Anything missing or invalid means 1 (run lines one after another).
+ */
+int batch_jobs(void)
+{
+  const char *env = getenv("WSH_JOBS");
+  if (env == NULL || *env == '\0')
+  {
+    return 1;
+  }
+  char *end;
+  long jobs = strtol(env, &end, 10);
+  if (*end != '\0' || jobs < 1 || jobs > SCHED_MAX_JOBS)
+  {
+    return 1;
+  }
+  return jobs;
+}
+
+/**
+ * @Brief Path of the duration database: WSH_SCHED_DB, or SCHED_DEFAULT_DB
+ * in $HOME. An empty WSH_SCHED_DB keeps durations in memory only.
+ *
+ * @return newly allocated path, NULL if there is none
+ */
+char *duration_db_path(void)
+{
+  const char *env = getenv("WSH_SCHED_DB");
+  if (env != NULL)
+  {
+    return *env == '\0' ? NULL : strdup(env);
+  }
+  const char *home = getenv("HOME");
+  char *path;
+  if (home == NULL || asprintf(&path, "%s/%s", home, SCHED_DEFAULT_DB) < 0)
+  {
+    return NULL;
+  }
+  return path;
+}
+
+/**
+ * @Brief Whether a script line has to run on its own, after every line
+ * before it and before any line after it. Builtins and assignments change
+ * the shell itself, blank lines let scripts mark groups explicitly, and
+ * lines that can't be parsed quietly are run on their own to be safe.
+ * Pipelines run every segment in a child, so they never change the shell.
+ *
+ * @param line a script line
+ * @return 1 if the line is a barrier, 0 if it can run alongside others
+ */
+int is_barrier_line(const char *line)
+{
+  if (strchr(line, '|') != NULL)
+  {
+    return 0;
+  }
+  char *argv[MAX_ARGS];
+  int argc;
+  parseline_quiet(line, argv, &argc);
+  int barrier = argc == 0 || is_builtin_command(argv[0]) == 0 || strchr(argv[0], '=') != NULL;
+  free_argv(argv, argc);
+  return barrier;
+}
+
+/**
+ * @Brief Run a group of independent lines, up to jobs at a time, longest
+ * first according to the duration database. Lines without history are
+ * expected to take as long as the average line of the group that has one.
+ *
+ * @param group the lines, in script order
+ * @param n number of lines
+ * @param jobs number of lines run at once
+ * @param db durations from earlier runs, updated with this one
+ * @param sfp the script file (closed in the children)
+ * @param lines_read number of script lines read so far
+ * @param final_status set to the exit status of the group's last line
+ * @param known incremented for every line that had history
+ * @return predicted makespan of the group in seconds
+ */
+double run_group(SchedJob *group, size_t n, int jobs, DurationDb *db, FILE *sfp,
+                 long lines_read, int *final_status, long *known)
+{
+  double known_total = 0;
+  size_t num_known = 0;
+  for (size_t i = 0; i < n; i++)
+  {
+    group[i].known = ddb_lookup(db, group[i].line, &group[i].predicted);
+    if (group[i].known)
+    {
+      known_total += group[i].predicted;
+      num_known++;
+    }
+  }
+  for (size_t i = 0; i < n; i++)
+  {
+    if (!group[i].known)
+    {
+      group[i].predicted = num_known > 0 ? known_total / num_known : 0;
+    }
+  }
+  *known += num_known;
+
+  size_t *order = malloc(n * sizeof(size_t));
+  if (order == NULL)
+  {
+    perror("malloc");
+    exit(-1);
+  }
+  double predicted = sched_order(group, n, jobs, order);
+
+  // flush before forking so buffered output isn't written twice.
+  fflush(stdout);
+  fflush(stderr);
+
+  size_t next = 0;
+  int running = 0;
+  while (next < n || running > 0)
+  {
+    while (next < n && running < jobs)
+    {
+      SchedJob *job = &group[order[next++]];
+      job->start = sched_now();
+      job->pid = fork();
+      if (job->pid < 0)
+      {
+        perror("fork");
+        job->pid = 0;
+      }
+      else if (job->pid == 0)
+      {
+        if (prefetcher != NULL)
+        {
+          pf_free(prefetcher);
+          prefetcher = NULL;
+        }
+        int status = 0;
+        char *line = strdup(job->line);
+        free(order);
+        execute_batch_line(line, sfp, lines_read, &status);
+        free(line);
+        // close before exit(), which would move the parent's script offset.
+        fclose(sfp);
+        clean_exit(status);
+      }
+      else
+      {
+        running++;
+      }
+    }
+    if (running == 0)
+    {
+      continue;
+    }
+    prefetch_upcoming(lines_read);
+
+    int status;
+    pid_t pid = waitpid(-1, &status, 0);
+    if (pid < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      perror("waitpid");
+      break;
+    }
+    for (size_t i = 0; i < n; i++)
+    {
+      if (group[i].pid == pid)
+      {
+        ddb_record(db, group[i].line, sched_now() - group[i].start);
+        if (i == n - 1 && WIFEXITED(status))
+        {
+          *final_status = WEXITSTATUS(status);
+        }
+        group[i].pid = 0;
+        running--;
+        break;
+      }
+    }
+  }
+  free(order);
+  return predicted;
+}
+
+/**
+ * @Brief Batch mode with WSH_JOBS > 1. Lines between barriers (see
+ * is_barrier_line) are independent and run in parallel, scheduled by how
+ * long they took on earlier runs; barriers run on their own. The critical
+ * path is then the barriers plus the makespan of each group. With
+ * WSH_SCHED_REPORT set (and not 0), its prediction is reported against
+ * the actual time on stderr at the end.
+ *
+ * @param sfp the script file
+ * @param jobs number of lines run at once
+ * @return exit status of the last line run
+ */
+int parallel_batch(FILE *sfp, int jobs)
+{
+  char *db_path = duration_db_path();
+  DurationDb *db = ddb_open(db_path);
+  free(db_path);
+
+  char line[MAX_LINE + 1];
+  SchedJob *group = NULL;
+  size_t group_size = 0, group_capacity = 0;
+  int final_status = 0;
+  long lines_read = 0, num_lines = 0, known = 0;
+  double predicted = 0;
+  double start = sched_now();
+  int done = 0;
+
+  prefetch_upcoming(lines_read);
+  while (!done)
+  {
+    int at_eof = fgets(line, sizeof(line), sfp) == NULL;
+    int blank = !at_eof && line[strspn(line, " \t\n")] == '\0';
+    if (!at_eof)
+    {
+      lines_read++;
+      num_lines += !blank;
+    }
+    if (!at_eof && !is_barrier_line(line))
     {
-      int is_valid_pipeline = 1;
-
-      // Validate if commands exist.
-      for (int i = 0; i < num_commands; i++)
+      if (group_size == group_capacity)
       {
-        char *command_path = NULL;
-
-        parseline_no_subst(commands[i], argv, &argc);
-        substitute_alias(argv, &argc);
-
-        if (argc == 0)
+        group_capacity = group_capacity ? group_capacity * 2 : 16;
+        group = realloc(group, group_capacity * sizeof(SchedJob));
+        if (group == NULL)
         {
-          is_valid_pipeline = 0;
-          wsh_warn(EMPTY_PIPE_SEGMENT);
-        }
-        else if (is_builtin_command(argv[0]) == 1 && (command_path = get_command_path(argv[0])) == NULL)
-        {
-          is_valid_pipeline = 0;
+          perror("realloc");
+          exit(-1);
         }
-
-        free_argv(argv, argc);
-        free(command_path);
       }
+      group[group_size].line = strdup(line);
+      group[group_size].pid = 0;
+      group_size++;
+      da_put(history_da, line);
+      continue;
+    }
 
-      if (is_valid_pipeline)
+    if (group_size > 0)
+    {
+      predicted += run_group(group, group_size, jobs, db, sfp, lines_read, &final_status, &known);
+      for (size_t i = 0; i < group_size; i++)
       {
-        // Create all pipes.
-        int num_pipes = num_commands - 1;
-        int pipes[num_pipes][2];
-        for (int i = 0; i < num_pipes; i++)
-        {
-          if (pipe(pipes[i]) < 0)
-          {
-            perror("pipe");
-            break;
-          }
-        }
+        free(group[i].line);
+      }
+      group_size = 0;
+    }
+    if (at_eof)
+    {
+      break;
+    }
 
-        // Start all child processes.
-        pid_t pids[num_commands];
-        for (int i = 0; i < num_commands; i++)
-        {
-          pids[i] = fork();
-          if (pids[i] < 0)
-          {
-            perror("fork");
-            break;
-          }
-          else if (pids[i] == 0)
-          {
-            fclose(sfp);
-            // first command should read from regular stdin
-            if (i > 0)
-            {
-              dup2(pipes[i - 1][0], STDIN_FILENO);
-            }
-            // last command should write to regular stdout
-            if (i < num_commands - 1)
-            {
-              dup2(pipes[i][1], STDOUT_FILENO);
-            }
+    // the barrier itself, on its own.
+    if (blank)
+    {
+      done = execute_batch_line(line, sfp, lines_read, &final_status);
+      continue;
+    }
+    char *key = strdup(line);
+    double estimate;
+    if (ddb_lookup(db, key, &estimate))
+    {
+      predicted += estimate;
+      known++;
+    }
+    double line_start = sched_now();
+    done = execute_batch_line(line, sfp, lines_read, &final_status);
+    ddb_record(db, key, sched_now() - line_start);
+    free(key);
+  }
 
-            for (int j = 0; j < num_pipes; j++)
-            {
-              close(pipes[j][0]);
-              close(pipes[j][1]);
-            }
+  const char *report = getenv("WSH_SCHED_REPORT");
+  if (num_lines > 0 && report != NULL && *report != '\0' && strcmp(report, "0") != 0)
+  {
+    fflush(stdout);
+    fprintf(stderr, SCHED_REPORT, jobs, predicted, sched_now() - start, known, num_lines);
+  }
+  free(group);
+  ddb_save(db);
+  ddb_free(db);
+  return final_status;
+}
 
-            parseline_no_subst(commands[i], argv, &argc);
-            substitute_alias(argv, &argc);
-            if (argc == 0)
-            {
-              wsh_warn(EMPTY_PIPE_SEGMENT);
-              free(line_dup_for_history);
-              free_argv(argv, argc);
-              clean_exit(EXIT_FAILURE);
-            }
+/**
+ * @Brief Batch mode: read commands from script file line by line
+ * execute each command and repeat until EOF
+ *
+ * @param script_file Path to the script file
+ * @return EXIT_SUCCESS(0) on success, EXIT_FAILURE(1) on error
+ */
 
-            int res = execute_builtin(argv, argc);
-            if (res == 0 || res == 1 || res == 2)
-            {
-              free_argv(argv, argc);
-              free(line_dup_for_history);
-              clean_exit(EXIT_SUCCESS);
-            }
+int batch_main(const char *script_file)
+{
+  FILE *sfp = fopen(script_file, "r");
+  if (sfp == NULL)
+  {
+    perror("fopen");
+    clean_exit(EXIT_FAILURE);
+  }
 
-            char *full_path = get_command_path(argv[0]);
-            if (full_path != NULL)
-            {
-              execv(full_path, argv);
-              free(full_path);
-            }
-            free(line_dup_for_history);
-            free_argv(argv, argc);
-            clean_exit(EXIT_FAILURE);
-          }
-        }
+  char line[MAX_LINE + 1];
+  int final_status = 0;
+  long lines_read = 0;
 
-        for (int i = 0; i < num_pipes; i++)
-        {
-          close(pipes[i][0]);
-          close(pipes[i][1]);
-        }
+  prefetcher = create_prefetcher(script_file);
+  int jobs = batch_jobs();
+  if (jobs > 1)
+  {
+    final_status = parallel_batch(sfp, jobs);
+    fclose(sfp);
+    return final_status;
+  }
 
-        // parent wait for every child to finish before reading next line.
-        for (int i = 0; i < num_commands; i++)
-        {
-          int status;
-          waitpid(pids[i], &status, 0);
-          // only get the exit status of the last command.
-          if (i == num_commands - 1 && WIFEXITED(status))
-          {
-            final_status = WEXITSTATUS(status);
-          }
-        }
-      }
+  prefetch_upcoming(lines_read);
+  while (fgets(line, sizeof(line), sfp) != NULL)
+  {
+    lines_read++;
+    if (execute_batch_line(line, sfp, lines_read, &final_status) != 0)
+    {
+      break;
     }
-    da_put(history_da, line_dup_for_history);
-    free(line_dup_for_history);
   }
   fclose(sfp);
   return final_status;
@@ -1094,6 +2174,21 @@ int batch_main(const char *script_file)
  * @param argc Pointer to store the number of parsed arguments
  */
 void parseline_no_subst(const char *cmdline, char **argv, int *argc)
+{
+  parseline_words(cmdline, argv, argc, NULL, 0);
+}
+
+/**
+ * @Brief Parse a command line like parseline_no_subst, also recording
+ * which arguments were single-quoted (and so must not be expanded).
+ *
+ * @param cmdline The command line to parse
+ * @param argv Array to store the parsed arguments (must be preallocated)
+ * @param argc Pointer to store the number of parsed arguments
+ * @param quoted Set to 1 for each quoted argument, 0 otherwise (may be NULL)
+ * @param quiet If 1, a missing closing quote empties argv without a warning
+ */
+void parseline_words(const char *cmdline, char **argv, int *argc, int *quoted, int quiet)
 {
   if (!cmdline)
   {
@@ -1133,7 +2228,8 @@ void parseline_no_subst(const char *cmdline, char **argv, int *argc)
   {
     char *token_start = p;
     char *token = NULL;
-    if (*p == '\'')
+    int is_quoted = *p == '\'';
+    if (is_quoted)
     {
       token_start = ++p;
       token = strchr(p, '\'');
@@ -1141,7 +2237,10 @@ void parseline_no_subst(const char *cmdline, char **argv, int *argc)
       {
         /* Handle missing closing quote - Print `Missing closing quote` to
          * stderr */
-        wsh_warn(MISSING_CLOSING_QUOTE);
+        if (!quiet)
+        {
+          wsh_warn(MISSING_CLOSING_QUOTE);
+        }
         free(buf);
         for (int i = 0; i < count; i++)
           free(argv[i]);
@@ -1169,6 +2268,10 @@ void parseline_no_subst(const char *cmdline, char **argv, int *argc)
       free(buf);
       clean_exit(EXIT_FAILURE);
     }
+    if (quoted != NULL)
+    {
+      quoted[count] = is_quoted;
+    }
     count++;
     while (*p && (*p == ' '))
       p++;
@@ -1177,3 +2280,248 @@ void parseline_no_subst(const char *cmdline, char **argv, int *argc)
   *argc = count;
   free(buf);
 }
+
+/**
+ * @Brief Parse a command line and follow its aliases without printing
+ * anything, for looking at script lines before they run. A line with an
+ * unbalanced quote parses to nothing.
+ *
+ * @param cmdline The command line to parse
+ * @param argv Array to store the parsed arguments (must be preallocated)
+ * @param argc Pointer to store the number of parsed arguments
+ */
+void parseline_quiet(const char *cmdline, char **argv, int *argc)
+{
+  parseline_words(cmdline, argv, argc, NULL, 1);
+
+  // follow a bounded number of alias layers (substitute_alias has the cycle checks).
+  for (int depth = 0; *argc > 0 && depth < 8; depth++)
+  {
+    char *command = hm_get(alias_hm, argv[0]);
+    if (command == NULL)
+    {
+      break;
+    }
+    free_argv(argv, *argc);
+    parseline_words(command, argv, argc, NULL, 1);
+  }
+}
+
+/**
+ * @Brief Parse a command line into arguments, substitute aliases
+ * and expand array references.
+ *
+ * @param cmdline The command line to parse
+ * @param argv Array to store the parsed arguments (must be preallocated)
+ * @param argc Pointer to store the number of parsed arguments
+ * @return 0 on success, 1 if an array reference could not be expanded
+ *         (already reported; argv is then empty)
+ */
+int parseline(const char *cmdline, char **argv, int *argc)
+{
+  int quoted[MAX_ARGS];
+  parseline_words(cmdline, argv, argc, quoted, 0);
+
+  // an alias replaces the first word; the user's own words stay at the end.
+  int num_words = *argc;
+  int aliased = num_words > 0 && hm_get(alias_hm, argv[0]) != NULL;
+  substitute_alias(argv, argc);
+  if (aliased)
+  {
+    // shift is negative when an empty alias drops the first word,
+    // so map the flags from a copy.
+    int words_quoted[MAX_ARGS];
+    memcpy(words_quoted, quoted, num_words * sizeof(int));
+    int shift = *argc - num_words;
+    for (int i = 0; i < *argc; i++)
+    {
+      quoted[i] = (i - shift >= 1) ? words_quoted[i - shift] : 0;
+    }
+  }
+  return expand_arrays(argv, argc, quoted);
+}
+
+/**
+ * @Brief Evaluate one array reference (the text between `${` and `}`).
+ *
+ * @param ref The reference, eg: `a[@]`, `#a[@]`, `!m[@]`, `m[key]`, `a`
+ * @param len Number of characters in ref
+ * @param words Receives the resulting words
+ * @param is_list Set to 1 if the result is one word per element (`[@]`)
+ * @return 0 on success, 1 on a bad substitution,
+ *         2 if ref is not an array reference (leave it as is).
+ */
+int expand_array_ref(const char *ref, size_t len, DynamicArray *words, int *is_list)
+{
+  char op = '\0';
+  if (len > 0 && (ref[0] == '#' || ref[0] == '!'))
+  {
+    op = ref[0];
+    ref++;
+    len--;
+  }
+
+  size_t name_len;
+  char *key;
+  if (split_array_ref(ref, len, &name_len, &key) != 0)
+  {
+    return 2;
+  }
+
+  char *name = strndup(ref, name_len);
+  ShellArray *sa = at_get(array_tbl, name);
+  free(name);
+
+  // `${name}` only refers to an array if one exists.
+  if (key == NULL && sa == NULL && op == '\0')
+  {
+    return 2;
+  }
+
+  int all = key != NULL && (strcmp(key, "@") == 0 || strcmp(key, "*") == 0);
+  *is_list = all && key[0] == '@' && op != '#';
+  if (op == '!' && !all)
+  {
+    free(key);
+    return 1;
+  }
+
+  char buf[32];
+  if (all)
+  {
+    if (op == '#')
+    {
+      snprintf(buf, sizeof(buf), "%zu", sa == NULL ? 0 : sa_length(sa));
+      da_put(words, buf);
+    }
+    else if (sa != NULL)
+    {
+      sa_collect(sa, op == '!', words);
+    }
+  }
+  else
+  {
+    char *value = (sa == NULL) ? NULL : sa_get(sa, key == NULL ? "0" : key);
+    if (op == '#')
+    {
+      snprintf(buf, sizeof(buf), "%zu", value == NULL ? 0 : strlen(value));
+      da_put(words, buf);
+    }
+    else
+    {
+      da_put(words, value == NULL ? "" : value);
+    }
+  }
+  free(key);
+  return 0;
+}
+
+/**
+ * @Brief Expand `${...}` array references in every argument.
+ * An argument that is exactly `${a[@]}` or `${!a[@]}` becomes one argument
+ * per element; any other reference is replaced by its words joined by spaces.
+ *
+ * @param argv Parsed arguments (each one allocated); replaced in place
+ * @param argc Pointer to the number of arguments; updated in place
+ * @param quoted Which arguments were single-quoted and are left as is (may be NULL)
+ * @return 0 on success, 1 on error (argv is then emptied)
+ */
+int expand_arrays(char **argv, int *argc, const int *quoted)
+{
+  char *expanded[MAX_ARGS];
+  int count = 0;
+  int failed = 0;
+
+  for (int i = 0; i < *argc; i++)
+  {
+    char *word = argv[i];
+    size_t pos = 0;
+    char *start;
+    while (!failed && word != NULL && !(quoted != NULL && quoted[i]) && (start = strstr(word + pos, "${")) != NULL)
+    {
+      char *end = strchr(start + 2, '}');
+      if (end == NULL)
+      {
+        break;
+      }
+
+      size_t ref_pos = start - word;
+      size_t ref_len = end - start - 2;
+      DynamicArray *words = da_create(4);
+      int is_list = 0;
+      int res = expand_array_ref(start + 2, ref_len, words, &is_list);
+      if (res == 2)
+      {
+        pos = ref_pos + 2;
+      }
+      else if (res == 1)
+      {
+        wsh_warn(BAD_SUBSTITUTION, word);
+        failed = 1;
+      }
+      else if (is_list && ref_pos == 0 && end[1] == '\0')
+      {
+        // the whole argument is the list: one argument per element.
+        for (size_t j = 0; j < words->size && !failed; j++)
+        {
+          if (count >= MAX_ARGS - 1)
+          {
+            wsh_warn(TOO_MANY_ARGS);
+            failed = 1;
+            break;
+          }
+          expanded[count++] = strdup(words->data[j]);
+        }
+        free(word);
+        word = NULL;
+      }
+      else
+      {
+        char *joined = append(NULL, "");
+        for (size_t j = 0; j < words->size; j++)
+        {
+          if (j > 0)
+          {
+            joined = append(joined, " ");
+          }
+          joined = append(joined, words->data[j]);
+        }
+        char *new_word = replaceAt(word, ref_pos, ref_len + 3, joined);
+        pos = ref_pos + strlen(joined); // don't expand inside the values.
+        free(joined);
+        free(word);
+        word = new_word;
+      }
+      da_free(words);
+    }
+
+    if (word == NULL)
+    {
+      continue;
+    }
+    if (!failed && count >= MAX_ARGS - 1)
+    {
+      wsh_warn(TOO_MANY_ARGS);
+      failed = 1;
+    }
+    if (failed)
+    {
+      free(word);
+      continue;
+    }
+    expanded[count++] = word;
+  }
+
+  if (failed)
+  {
+    free_argv(expanded, count);
+    *argc = 0;
+    argv[0] = NULL;
+    return 1;
+  }
+
+  memcpy(argv, expanded, count * sizeof(char *));
+  argv[count] = NULL;
+  *argc = count;
+  return 0;
+}
@@ -23,6 +23,10 @@
 #define INVALID_WHICH_USE "Incorrect usage of which. Correct format: which name\n"
 #define INVALID_CD_USE "Incorrect usage of cd. Correct format: cd | cd directory\n"
 #define INVALID_HISTORY_USE "Incorrect usage of history. Correct format: history | history n\n"
+#define INVALID_DECLARE_USE "Incorrect usage of declare. Correct format: declare | declare -a|-A name ...\n"
+#define INVALID_SORT_USE "Incorrect usage of sort. Correct format: sort [-r] [-n] [-S size] [--parallel=n] [file ...]\n"
+#define INVALID_UNIQ_USE "Incorrect usage of uniq. Correct format: uniq [-c] [file]\n"
+#define INVALID_UNSET_USE "Incorrect usage of unset. Correct format: unset name ... | unset name[key] ...\n"
 
 #define WHICH_ALIAS "%s: aliased to '%s'\n"
 #define WHICH_BUILTIN "%s: wsh builtin\n"
@@ -33,6 +37,13 @@
 
 #define HISTORY_INVALID_ARG "Invalid argument passed to history\n"
 
+#define INVALID_ARRAY_ASSIGN "Invalid array assignment: %s\n"
+#define BAD_ARRAY_SUBSCRIPT "%s: bad array subscript\n"
+#define BAD_SUBSTITUTION "%s: bad substitution\n"
+#define TOO_MANY_ARGS "Too many arguments after expansion\n"
+#define INVALID_PROFILE "WSH_PROFILE must be a sampling rate from 1 to %d (Hz)\n"
+#define SCHED_REPORT "wsh: %d jobs: predicted makespan %.3fs, actual %.3fs (%ld of %ld lines had history)\n"
+
 /**************************************************
  * Modes of Execution
  *************************************************/
@@ -43,6 +54,10 @@ int batch_main(const char *script_file); /* Read a commands from script_file lin
  * Parsing
  *************************************************/
 void parseline_no_subst(const char *cmdline, char **argv, int *argc);
+void parseline_words(const char *cmdline, char **argv, int *argc, int *quoted, int quiet); /* Parse, recording which words were quoted */
+int parseline(const char *cmdline, char **argv, int *argc); /* Parse, then substitute aliases and expand arrays */
+void parseline_quiet(const char *cmdline, char **argv, int *argc); /* Parse and follow aliases without printing anything */
+int expand_arrays(char **argv, int *argc, const int *quoted); /* Expand unquoted ${name[...]} references in place */
 
 
 /**************************************************